@@ -0,0 +1,312 @@
+/*
+ * BranchAndBound.cpp
+ *
+ *
+ *      Authors: Sara Rouhani,Tahrima Rahman,Vibhav Gogate. The University of Texas at Dallas
+ *      Contacts: {sara.rouhani,tahrima.rahman,vibhav.gogate}@utdallas.edu
+ *
+ *      MIT License
+ *
+ *      Permission is hereby granted, free of charge, to any person obtaining a copy
+ *      of this software and associated documentation files (the "Software"), to deal
+ *      in the Software without restriction, including without limitation the rights
+ *      to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *      copies of the Software, and to permit persons to whom the Software is
+ *      furnished to do so, subject to the following conditions:
+ *
+ *      The above copyright notice and this permission notice shall be included in all
+ *      copies or substantial portions of the Software.
+ *
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *      AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *      LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *      OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *      SOFTWARE.
+ */
+
+#include "MN.h"
+#include "Knapsack.h"
+#include "Profiler.h"
+#include <cmath>
+#include <chrono>
+#include <iomanip>
+#include <algorithm>
+
+extern void RemoveDominatedItems(Bin &bin_);
+extern void ConvexHull(Bin &bin_);
+extern long double lp_bound_MCKP(MCKP &hulls, int first, long double max_cost);
+
+/*
+ * Depth-first branch and bound for CMPE over a k-separator decomposition.
+ *
+ * The cut variables are branched on first, in the order of the separator. At a node where only
+ * the first depth cut variables are assigned, each component becomes an MCKP bin whose items
+ * are relaxed over the unassigned cut variables: a potential that mentions one of them
+ * contributes its smallest weight and its largest value over their values. Potentials over
+ * cut variables only are relaxed the same way. The LP relaxation of the resulting MCKP is an
+ * upper bound on every completion of the node. Once all cut variables are assigned the bins
+ * are exact and the search branches on the item of each bin, bounding with the LP relaxation
+ * of the remaining bins.
+ */
+struct BranchAndBound {
+    MN& mn;
+    MN& mn_c;
+    Decomposition& d;
+    long double logq;
+    double time_limit;
+    long long node_limit;
+    std::chrono::steady_clock::time_point start;
+
+    // Position of every cut variable in the branching order
+    vector<int> cut_position;
+    // Cut variables of each potential of each component bucket
+    vector<vector<vector<int> > > potential_cuts;
+    // Potentials defined over cut variables only
+    vector<int> cut_potentials;
+    // Non-dominated items and their convex hull for each component at the current node
+    MCKP items;
+    MCKP hulls;
+    // Item chosen in each bin during the second phase
+    vector<long long> chosen;
+
+    long double incumbent;
+    vector<int> incumbent_assignment;
+    long long nodes;
+    bool aborted;
+    // Largest bound of a subtree that was left unexplored because of a limit
+    long double open_bound;
+    // Largest bound of a subtree pruned only because of the gap tolerance
+    long double pruned_bound;
+
+    BranchAndBound(MN& mn_, MN& mn_c_, Decomposition& d_, long double logq_) :
+            mn(mn_), mn_c(mn_c_), d(d_), logq(logq_), time_limit(0), node_limit(0),
+            incumbent(-1 * std::numeric_limits<long double>::max()), nodes(0), aborted(false),
+            open_bound(-1 * std::numeric_limits<long double>::max()),
+            pruned_bound(-1 * std::numeric_limits<long double>::max()) {}
+
+    void init();
+    void build_bin(int i, int depth);
+    long double tolerance();
+    bool out_of_budget();
+    bool prune(long double bound);
+    void branch_cut(int depth);
+    void branch_item(int bin, long double cost, long double profit);
+};
+
+void BranchAndBound::init()
+{
+    int num_components = d.component_variables.size();
+    cut_position = vector<int>(mn.variables.size(), -1);
+    for (int j = 0; j < d.cut_variables.size(); j++)
+        cut_position[d.cut_variables[j]->id] = j;
+    potential_cuts = vector<vector<vector<int> > >(num_components);
+    for (int i = 0; i < num_components; i++) {
+        for (std::set<int>::iterator it = d.buckets[i].begin(); it != d.buckets[i].end(); ++it) {
+            vector<int> cuts;
+            for (auto variable : mn.potentials[*it]->variables)
+                if (cut_position[variable->id] != -1)
+                    cuts.push_back(cut_position[variable->id]);
+            potential_cuts[i].push_back(cuts);
+        }
+    }
+    set<int>& last = d.buckets[d.buckets.size() - 1];
+    cut_potentials = vector<int>(last.begin(), last.end());
+    items = MCKP(num_components);
+    hulls = MCKP(num_components);
+    chosen = vector<long long>(num_components, 0);
+}
+
+// Smallest weight and largest value of a potential over all values of the given unassigned variables
+static void relax_potential(Potential* weight, Potential* value, const vector<Variable*>& free_variables,
+                            long double& min_weight, long double& max_value)
+{
+    min_weight = std::numeric_limits<long double>::max();
+    max_value = -1 * std::numeric_limits<long double>::max();
+    vector<int> saved(free_variables.size());
+    for (int v = 0; v < free_variables.size(); v++)
+        saved[v] = free_variables[v]->value;
+    long long num_values = Variable::getDomainSize(free_variables);
+    for (long long a = 0; a < num_values; a++) {
+        Variable::setAddress(free_variables, a);
+        min_weight = std::min(min_weight, weight->getValue());
+        max_value = std::max(max_value, value->getValue());
+    }
+    for (int v = 0; v < free_variables.size(); v++)
+        free_variables[v]->value = saved[v];
+}
+
+// Relaxed bin of component i when the cut variables at positions >= depth are unassigned
+void BranchAndBound::build_bin(int i, int depth)
+{
+    vector<int> bucket(d.buckets[i].begin(), d.buckets[i].end());
+    vector<vector<Variable*> > free_variables(bucket.size());
+    for (int p = 0; p < bucket.size(); p++)
+        for (int j : potential_cuts[i][p])
+            if (j >= depth)
+                free_variables[p].push_back(d.cut_variables[j]);
+    vector<Variable*>& variables = d.component_variables[i];
+    long long num_values = Variable::getDomainSize(variables);
+    Bin bin(num_values);
+    for (long long a = 0; a < num_values; a++) {
+        Variable::setAddress(variables, a);
+        bin[a].cost = 0.0;
+        bin[a].profit = 0.0;
+        bin[a].pos_in_bin = a;
+        for (int p = 0; p < bucket.size(); p++) {
+            if (free_variables[p].empty()) {
+                bin[a].cost += mn.potentials[bucket[p]]->getValue();
+                bin[a].profit += mn_c.potentials[bucket[p]]->getValue();
+            } else {
+                long double min_weight, max_value;
+                relax_potential(mn.potentials[bucket[p]], mn_c.potentials[bucket[p]], free_variables[p], min_weight, max_value);
+                bin[a].cost += min_weight;
+                bin[a].profit += max_value;
+            }
+        }
+    }
+    RemoveDominatedItems(bin);
+    items[i] = bin;
+    ConvexHull(bin);
+    hulls[i] = bin;
+}
+
+long double BranchAndBound::tolerance()
+{
+    if (incumbent == -1 * std::numeric_limits<long double>::max())
+        return 0.0;
+    return GlobalSearchOptions::gap * fabsl(incumbent);
+}
+
+bool BranchAndBound::out_of_budget()
+{
+    if (aborted)
+        return true;
+    if (node_limit > 0 && nodes >= node_limit)
+        aborted = true;
+    else if (time_limit > 0 && (nodes & 255) == 0 &&
+             std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() >= time_limit)
+        aborted = true;
+    return aborted;
+}
+
+// Returns true if the subtree with the given bound need not be explored
+bool BranchAndBound::prune(long double bound)
+{
+    if (bound <= incumbent)
+        return true;
+    if (bound <= incumbent + tolerance()) {
+        pruned_bound = std::max(pruned_bound, bound);
+        return true;
+    }
+    if (out_of_budget()) {
+        open_bound = std::max(open_bound, bound);
+        return true;
+    }
+    return false;
+}
+
+void BranchAndBound::branch_cut(int depth)
+{
+    nodes++;
+    // Bound contributed by the potentials over cut variables only
+    long double cut_weight = 0.0;
+    long double cut_value = 0.0;
+    for (int p : cut_potentials) {
+        vector<Variable*> free_variables;
+        for (auto variable : mn.potentials[p]->variables)
+            if (cut_position[variable->id] >= depth)
+                free_variables.push_back(variable);
+        long double min_weight, max_value;
+        relax_potential(mn.potentials[p], mn_c.potentials[p], free_variables, min_weight, max_value);
+        cut_weight += min_weight;
+        cut_value += max_value;
+    }
+    long double lp = lp_bound_MCKP(hulls, 0, logq - cut_weight);
+    if (lp == -1 * std::numeric_limits<long double>::max())
+        return;
+    if (prune(cut_value + lp))
+        return;
+    if (depth == d.cut_variables.size()) {
+        // All cut variables are assigned: the relaxed quantities are exact
+        branch_item(0, cut_weight, cut_value);
+        return;
+    }
+    Variable* variable = d.cut_variables[depth];
+    // Try the value of the incumbent first
+    int first = incumbent_assignment.empty() ? 0 : incumbent_assignment[variable->id];
+    for (int t = 0; t < variable->domain_size; t++) {
+        variable->value = (first + t) % variable->domain_size;
+        vector<int>& affected = d.cut_components[depth];
+        vector<Bin> saved_items(affected.size());
+        vector<Bin> saved_hulls(affected.size());
+        for (int c = 0; c < affected.size(); c++) {
+            saved_items[c] = items[affected[c]];
+            saved_hulls[c] = hulls[affected[c]];
+            build_bin(affected[c], depth + 1);
+        }
+        branch_cut(depth + 1);
+        for (int c = 0; c < affected.size(); c++) {
+            items[affected[c]] = saved_items[c];
+            hulls[affected[c]] = saved_hulls[c];
+        }
+    }
+}
+
+void BranchAndBound::branch_item(int bin, long double cost, long double profit)
+{
+    if (bin == items.size()) {
+        if (cost <= logq && profit > incumbent) {
+            incumbent = profit;
+            for (int i = 0; i < items.size(); i++)
+                Variable::setAddress(d.component_variables[i], chosen[i]);
+            mn.get_assignment(incumbent_assignment);
+            cerr << std::setprecision(20) << "Branch and bound: new incumbent " << incumbent << " after " << nodes << " nodes\n";
+        }
+        return;
+    }
+    nodes++;
+    long double lp = lp_bound_MCKP(hulls, bin, logq - cost);
+    if (lp == -1 * std::numeric_limits<long double>::max())
+        return;
+    if (prune(profit + lp))
+        return;
+    // Most profitable items first; after RemoveDominatedItems they are the last ones
+    for (int j = items[bin].size() - 1; j >= 0; j--) {
+        chosen[bin] = items[bin][j].pos_in_bin;
+        branch_item(bin + 1, cost + items[bin][j].cost, profit + items[bin][j].profit);
+    }
+}
+
+BranchAndBoundResult MN::branch_and_bound(MN& mn_c, long double logq, int k, long double incumbent, const vector<int>& incumbent_assignment,
+                                          double time_limit, long long node_limit)
+{
+    PROFILE_SCOPE("branch_and_bound");
+    Decomposition d;
+    decompose(k, d);
+    BranchAndBound bb(*this, mn_c, d, logq);
+    bb.time_limit = time_limit;
+    bb.node_limit = node_limit;
+    bb.start = std::chrono::steady_clock::now();
+    bb.incumbent = incumbent;
+    bb.incumbent_assignment = incumbent_assignment;
+    bb.init();
+    vector<int> saved;
+    get_assignment(saved);
+    if (!incumbent_assignment.empty())
+        set_assignment(incumbent_assignment);
+    for (int i = 0; i < d.component_variables.size(); i++)
+        bb.build_bin(i, 0);
+    bb.branch_cut(0);
+    set_assignment(saved);
+
+    BranchAndBoundResult result;
+    result.lower_bound = bb.incumbent;
+    result.upper_bound = std::max(bb.incumbent, std::max(bb.open_bound, bb.pruned_bound));
+    result.assignment = bb.incumbent_assignment;
+    result.nodes = bb.nodes;
+    result.complete = !bb.aborted;
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - bb.start).count();
+    return result;
+}
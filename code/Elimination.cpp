@@ -0,0 +1,586 @@
+/*
+ * Elimination.cpp
+ *
+ *
+ *      Authors: Sara Rouhani,Tahrima Rahman,Vibhav Gogate. The University of Texas at Dallas
+ *      Contacts: {sara.rouhani,tahrima.rahman,vibhav.gogate}@utdallas.edu
+ *
+ *      MIT License
+ *
+ *      Permission is hereby granted, free of charge, to any person obtaining a copy
+ *      of this software and associated documentation files (the "Software"), to deal
+ *      in the Software without restriction, including without limitation the rights
+ *      to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *      copies of the Software, and to permit persons to whom the Software is
+ *      furnished to do so, subject to the following conditions:
+ *
+ *      The above copyright notice and this permission notice shall be included in all
+ *      copies or substantial portions of the Software.
+ *
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *      AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *      LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *      OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *      SOFTWARE.
+ */
+
+#include "MN.h"
+#include "Profiler.h"
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+
+// Number of edges that eliminating v would add between its neighbours
+static long long fill_in(vector <set<int>>& graph, int v)
+{
+    long long fill = 0;
+    for (auto a = graph[v].begin(); a != graph[v].end(); ++a)
+        for (auto b = std::next(a); b != graph[v].end(); ++b)
+            if (graph[*a].find(*b) == graph[*a].end())
+                fill++;
+    return fill;
+}
+
+// Min-fill elimination ordering of the primal graph; induced_width receives the width of the ordering
+vector<int> MN::min_fill_ordering(int& induced_width)
+{
+    vector <set<int>> graph = primal_graph();
+    vector<bool> eliminated(variables.size(), false);
+    vector<long long> fill(variables.size());
+    for (int v = 0; v < variables.size(); v++)
+        fill[v] = fill_in(graph, v);
+    vector<int> order;
+    induced_width = 0;
+    for (int t = 0; t < variables.size(); t++) {
+        int best = -1;
+        for (int v = 0; v < variables.size(); v++) {
+            if (eliminated[v]) continue;
+            if (best == -1 || fill[v] < fill[best] || (fill[v] == fill[best] && graph[v].size() < graph[best].size()))
+                best = v;
+        }
+        induced_width = std::max(induced_width, (int) graph[best].size());
+        set<int> neighbours = graph[best];
+        for (auto a = neighbours.begin(); a != neighbours.end(); ++a) {
+            for (auto b = std::next(a); b != neighbours.end(); ++b) {
+                graph[*a].insert(*b);
+                graph[*b].insert(*a);
+            }
+            graph[*a].erase(best);
+        }
+        graph[best] = set<int>();
+        eliminated[best] = true;
+        order.push_back(best);
+        // Only the neighbours of the eliminated variable and their neighbours change fill-in
+        set<int> changed;
+        for (int a : neighbours) {
+            changed.insert(a);
+            changed.insert(graph[a].begin(), graph[a].end());
+        }
+        for (int v : changed)
+            fill[v] = fill_in(graph, v);
+    }
+    return order;
+}
+
+/*
+ * Mini-bucket elimination for max-sum over log-potentials.
+ * Every function goes to the bucket of its first variable in order. The functions of a
+ * bucket are split greedily into mini-buckets whose joint scope has at most i_bound+1
+ * variables; each mini-bucket is summed and maximized over the bucket variable separately,
+ * which upper bounds the exact message. The returned value is therefore an upper bound on
+ * max_x sum_f f(x), and exact is set when no bucket had to be split.
+ * assignment receives the assignment decoded greedily in reverse order from the buckets.
+ */
+long double MN::max_sum_elimination(const vector<Potential*>& functions, const vector<int>& order, int i_bound,
+                                    vector<int>& assignment, bool& exact)
+{
+    vector<int> position(variables.size());
+    for (int t = 0; t < order.size(); t++)
+        position[order[t]] = t;
+    // Messages are owned here; original functions are not
+    vector<Potential*> messages;
+    vector<vector<Potential*> > buckets(order.size());
+    long double constant = 0.0;
+    for (auto function : functions) {
+        if (function->variables.empty()) {
+            constant += function->table[0];
+            continue;
+        }
+        int first = order.size();
+        for (auto variable : function->variables)
+            first = std::min(first, position[variable->id]);
+        buckets[first].push_back(function);
+    }
+    exact = true;
+    for (int t = 0; t < order.size(); t++) {
+        Variable* variable = variables[order[t]];
+        // Greedy partition of the bucket into mini-buckets by scope size
+        vector<set<int> > scopes;
+        vector<vector<Potential*> > mini_buckets;
+        for (auto function : buckets[t]) {
+            int m = 0;
+            for (; m < scopes.size(); m++) {
+                set<int> scope = scopes[m];
+                for (auto v : function->variables)
+                    scope.insert(v->id);
+                if (scope.size() <= i_bound + 1) {
+                    scopes[m] = scope;
+                    mini_buckets[m].push_back(function);
+                    break;
+                }
+            }
+            if (m == scopes.size()) {
+                set<int> scope;
+                for (auto v : function->variables)
+                    scope.insert(v->id);
+                scopes.push_back(scope);
+                mini_buckets.push_back(vector<Potential*>(1, function));
+            }
+        }
+        if (mini_buckets.size() > 1)
+            exact = false;
+        for (int m = 0; m < mini_buckets.size(); m++) {
+            vector<Variable*> scope;
+            for (int v : scopes[m])
+                if (v != variable->id)
+                    scope.push_back(variables[v]);
+            Potential* message = new Potential();
+            message->variables = scope;
+            long long num_values = Variable::getDomainSize(scope);
+            vector<long double> table(num_values, -1 * std::numeric_limits<long double>::max());
+            for (long long a = 0; a < num_values; a++) {
+                Variable::setAddress(scope, a);
+                for (int x = 0; x < variable->domain_size; x++) {
+                    variable->value = x;
+                    long double sum = 0.0;
+                    for (auto function : mini_buckets[m])
+                        sum += function->getValue();
+                    table[a] = std::max(table[a], sum);
+                }
+            }
+            message->table = std::move(table);
+            messages.push_back(message);
+            if (scope.empty()) {
+                constant += message->table[0];
+                continue;
+            }
+            int first = order.size();
+            for (auto v : scope)
+                first = std::min(first, position[v->id]);
+            buckets[first].push_back(message);
+        }
+    }
+    // Decode: each variable takes the value maximizing its bucket given the later variables
+    for (int t = order.size() - 1; t >= 0; t--) {
+        Variable* variable = variables[order[t]];
+        long double best = -1 * std::numeric_limits<long double>::max();
+        int best_value = 0;
+        for (int x = 0; x < variable->domain_size; x++) {
+            variable->value = x;
+            long double sum = 0.0;
+            for (auto function : buckets[t])
+                sum += function->getValue();
+            if (sum > best) {
+                best = sum;
+                best_value = x;
+            }
+        }
+        variable->value = best_value;
+    }
+    get_assignment(assignment);
+    for (auto message : messages)
+        delete message;
+    return constant;
+}
+
+/*
+ * Entries of the messages max_sum_elimination would create for these functions, order and
+ * i_bound. The buckets are split as there, on scopes only, so no table is computed. Stops
+ * counting once the entries exceed max_entries.
+ */
+long long MN::mini_bucket_entries(const vector<Potential*>& functions, const vector<int>& order, int i_bound, long long max_entries)
+{
+    vector<int> position(variables.size());
+    for (int t = 0; t < order.size(); t++)
+        position[order[t]] = t;
+    vector<vector<set<int> > > buckets(order.size());
+    for (auto function : functions) {
+        if (function->variables.empty())
+            continue;
+        set<int> scope;
+        int first = order.size();
+        for (auto variable : function->variables) {
+            scope.insert(variable->id);
+            first = std::min(first, position[variable->id]);
+        }
+        buckets[first].push_back(scope);
+    }
+    long long entries = 0;
+    for (int t = 0; t < order.size(); t++) {
+        vector<set<int> > scopes;
+        for (auto& function_scope : buckets[t]) {
+            int m = 0;
+            for (; m < scopes.size(); m++) {
+                set<int> scope = scopes[m];
+                scope.insert(function_scope.begin(), function_scope.end());
+                if (scope.size() <= i_bound + 1) {
+                    scopes[m] = scope;
+                    break;
+                }
+            }
+            if (m == scopes.size())
+                scopes.push_back(function_scope);
+        }
+        for (auto& scope : scopes) {
+            scope.erase(order[t]);
+            long long num_values = 1;
+            for (int v : scope) {
+                num_values *= variables[v]->domain_size;
+                if (num_values > max_entries)
+                    return max_entries + 1;
+            }
+            entries += num_values;
+            if (entries > max_entries)
+                return max_entries + 1;
+            if (scope.empty())
+                continue;
+            int first = order.size();
+            for (int v : scope)
+                first = std::min(first, position[v]);
+            buckets[first].push_back(scope);
+        }
+    }
+    return entries;
+}
+
+/*
+ * Lagrangian dual of CMPE: for lambda >= 0,
+ *      L(lambda) = lambda * logq + max_x [value(x) - lambda * weight(x)]
+ * is an upper bound on the optimal value. The inner maximization is solved by max-sum
+ * elimination on the combined network (exactly if its induced width is at most i_bound,
+ * otherwise the mini-bucket upper bound is used). L is convex in lambda; its slope at lambda is
+ * logq - weight(x_lambda), so lambda is bracketed by doubling and then bisected on the sign
+ * of the slope. Decoded assignments that satisfy the constraint are kept as primal solutions.
+ */
+LagrangianResult MN::lagrangian_bound(MN& mn_c, long double logq, int i_bound, int num_iterations)
+{
+    PROFILE_SCOPE("lagrangian_bound");
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    LagrangianResult result;
+    result.bound = std::numeric_limits<long double>::max();
+    result.primal = -1 * std::numeric_limits<long double>::max();
+    result.evaluations = 0;
+    result.exact = true;
+    vector<int> saved;
+    get_assignment(saved);
+    vector<int> order = min_fill_ordering(result.induced_width);
+    // Scaled copies of the weight potentials: table entries are -lambda * weight
+    vector<Potential> scaled(potentials.size());
+    vector<Potential*> functions;
+    for (int i = 0; i < mn_c.potentials.size(); i++)
+        functions.push_back(mn_c.potentials[i]);
+    for (int i = 0; i < potentials.size(); i++) {
+        scaled[i].variables = potentials[i]->variables;
+        functions.push_back(&scaled[i]);
+    }
+    long double lo = 0.0, hi = 0.0;
+    bool bracketed = false;
+    for (int iteration = 0; iteration < num_iterations; iteration++) {
+        long double lambda;
+        if (iteration == 0)
+            lambda = 0.0;
+        else if (!bracketed)
+            lambda = hi = (hi == 0.0 ? 1.0 : 2 * hi);
+        else
+            lambda = (lo + hi) / 2;
+        for (int i = 0; i < potentials.size(); i++) {
+            vector<long double> table(potentials[i]->table.values());
+            // Forbidden (-inf) entries stay forbidden
+            for (auto& entry : table)
+                if (!std::isinf(entry))
+                    entry *= -lambda;
+            scaled[i].table = std::move(table);
+        }
+        vector<int> assignment;
+        bool exact;
+        long double inner = max_sum_elimination(functions, order, i_bound, assignment, exact);
+        result.evaluations++;
+        result.exact = result.exact && exact;
+        long double bound = lambda * logq + inner;
+        if (bound < result.bound) {
+            result.bound = bound;
+            result.lambda = lambda;
+        }
+        set_assignment(assignment);
+        long double weight = getValue();
+        if (weight <= logq) {
+            long double value = mn_c.getValue();
+            if (value > result.primal) {
+                result.primal = value;
+                result.assignment = assignment;
+            }
+            // The unconstrained maximizer is feasible: no larger lambda can help
+            if (lambda == 0.0)
+                break;
+            bracketed = true;
+            hi = lambda;
+        } else {
+            lo = lambda;
+        }
+    }
+    set_assignment(saved);
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+/*
+ * Bi-objective bucket elimination.
+ * A Pareto function maps every assignment of its scope to a frontier of (weight, value)
+ * pairs: the weights and values of the partial assignments it summarizes that are not
+ * dominated (smaller or equal weight and larger or equal value). Every point remembers how it
+ * was produced so that an assignment can be decoded for any point of the final frontier.
+ */
+struct ParetoPoint {
+    long double weight;
+    long double value;
+    // Index into the provenance of the function owning the point; -1 for original potentials
+    int from;
+};
+
+struct ParetoFunction {
+    vector<Variable*> variables;
+    vector<vector<ParetoPoint> > table;
+    // Variable eliminated to produce the function (nullptr for original potentials)
+    Variable* eliminated;
+    // Functions combined to produce the function
+    vector<ParetoFunction*> inputs;
+    // provenance[p]: value of the eliminated variable followed by one point index per input
+    vector<vector<int> > provenance;
+    ParetoFunction() : eliminated(nullptr) {}
+};
+
+struct ParetoCandidate {
+    long double weight;
+    long double value;
+    vector<int> indices;
+};
+
+static bool ParetoCandidate_sorter(ParetoCandidate const &lhs, ParetoCandidate const &rhs)
+{
+    if (lhs.weight != rhs.weight)
+        return lhs.weight < rhs.weight;
+    return lhs.value > rhs.value;
+}
+
+// Keeps the candidates that are not delta-dominated: a candidate is dropped if a kept
+// candidate has smaller or equal weight and a value at most delta smaller
+static void prune_frontier(vector<ParetoCandidate>& candidates, long double delta)
+{
+    sort(candidates.begin(), candidates.end(), &ParetoCandidate_sorter);
+    vector<ParetoCandidate> frontier;
+    long double max_value = -1 * std::numeric_limits<long double>::max();
+    for (int i = 0; i < candidates.size(); i++) {
+        if (!frontier.empty() && candidates[i].value <= max_value + delta)
+            continue;
+        max_value = std::max(max_value, candidates[i].value);
+        frontier.push_back(candidates[i]);
+    }
+    candidates.swap(frontier);
+}
+
+// Minkowski sum of the candidates with a frontier, recording the index of the point used
+static void add_frontier(vector<ParetoCandidate>& candidates, const vector<ParetoPoint>& frontier, long double delta)
+{
+    vector<ParetoCandidate> sums;
+    sums.reserve(candidates.size() * frontier.size());
+    for (int c = 0; c < candidates.size(); c++) {
+        for (int p = 0; p < frontier.size(); p++) {
+            ParetoCandidate sum;
+            sum.weight = candidates[c].weight + frontier[p].weight;
+            sum.value = candidates[c].value + frontier[p].value;
+            sum.indices = candidates[c].indices;
+            sum.indices.push_back(p);
+            sums.push_back(sum);
+        }
+    }
+    prune_frontier(sums, delta);
+    candidates.swap(sums);
+}
+
+// Sets the eliminated variables of the subtree that produced point p of function f
+static void decode_point(ParetoFunction* f, int p)
+{
+    const vector<ParetoPoint>& frontier = f->table[Variable::getAddress(f->variables)];
+    int from = frontier[p].from;
+    if (from == -1)
+        return;
+    vector<int>& provenance = f->provenance[from];
+    f->eliminated->value = provenance[0];
+    for (int i = 0; i < f->inputs.size(); i++)
+        decode_point(f->inputs[i], provenance[i + 1]);
+}
+
+// Largest message scope of bucket elimination along order over the potentials of both networks
+static int elimination_width(const vector<Potential*>& p1, const vector<Potential*>& p2, const vector<int>& order,
+                             const vector<int>& position)
+{
+    vector<vector<set<int> > > buckets(order.size());
+    for (int n = 0; n < 2; n++) {
+        for (auto potential : n == 0 ? p1 : p2) {
+            if (potential->variables.empty()) continue;
+            set<int> scope;
+            int first = order.size();
+            for (auto v : potential->variables) {
+                scope.insert(v->id);
+                first = std::min(first, position[v->id]);
+            }
+            buckets[first].push_back(scope);
+        }
+    }
+    int width = 0;
+    for (int t = 0; t < order.size(); t++) {
+        set<int> scope;
+        for (auto& s : buckets[t])
+            scope.insert(s.begin(), s.end());
+        scope.erase(order[t]);
+        width = std::max(width, (int) scope.size());
+        if (scope.empty()) continue;
+        int first = order.size();
+        for (int v : scope)
+            first = std::min(first, position[v]);
+        buckets[first].push_back(scope);
+    }
+    return width;
+}
+
+ParetoResult MN::pareto_elimination(MN& mn_c, const vector<long double>& logqs, long double epsilon, int max_width)
+{
+    PROFILE_SCOPE("pareto_elimination");
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    ParetoResult result;
+    result.max_frontier = 0;
+    result.values = vector<long double>(logqs.size(), -1 * std::numeric_limits<long double>::max());
+    result.assignments = vector<vector<int> >(logqs.size());
+    vector<int> order = min_fill_ordering(result.induced_width);
+    vector<int> position(variables.size());
+    for (int t = 0; t < order.size(); t++)
+        position[order[t]] = t;
+    // The value network may add edges to the ordering of the weight network
+    result.induced_width = elimination_width(potentials, mn_c.potentials, order, position);
+    result.complete = result.induced_width <= max_width;
+    if (!result.complete) {
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return result;
+    }
+    vector<ParetoFunction*> functions;
+    // Original potentials: a single point per entry, weight from this network and value from mn_c
+    for (int n = 0; n < 2; n++) {
+        vector<Potential*>& source = n == 0 ? potentials : mn_c.potentials;
+        for (auto potential : source) {
+            ParetoFunction* f = new ParetoFunction();
+            f->variables = potential->variables;
+            f->table = vector<vector<ParetoPoint> >(potential->table.size(), vector<ParetoPoint>(1));
+            for (int a = 0; a < potential->table.size(); a++) {
+                f->table[a][0].weight = n == 0 ? potential->table[a] : 0.0;
+                f->table[a][0].value = n == 0 ? 0.0 : potential->table[a];
+                f->table[a][0].from = -1;
+            }
+            functions.push_back(f);
+        }
+    }
+    // Every pruning may lose up to delta of value, and no point goes through more than this many
+    long double delta = epsilon > 0 ? log1pl(epsilon) / (functions.size() + 2 * variables.size() + 1) : 0.0;
+    vector<vector<ParetoFunction*> > buckets(order.size());
+    vector<ParetoFunction*> roots;
+    for (auto f : functions) {
+        if (f->variables.empty()) {
+            roots.push_back(f);
+            continue;
+        }
+        int first = order.size();
+        for (auto v : f->variables)
+            first = std::min(first, position[v->id]);
+        buckets[first].push_back(f);
+    }
+    vector<int> saved;
+    get_assignment(saved);
+    for (int t = 0; t < order.size(); t++) {
+        if (buckets[t].empty()) continue;
+        Variable* variable = variables[order[t]];
+        set<int> ids;
+        for (auto f : buckets[t])
+            for (auto v : f->variables)
+                if (v != variable)
+                    ids.insert(v->id);
+        ParetoFunction* message = new ParetoFunction();
+        for (int id : ids)
+            message->variables.push_back(variables[id]);
+        message->eliminated = variable;
+        message->inputs = buckets[t];
+        long long num_values = Variable::getDomainSize(message->variables);
+        message->table = vector<vector<ParetoPoint> >(num_values);
+        for (long long a = 0; a < num_values; a++) {
+            Variable::setAddress(message->variables, a);
+            vector<ParetoCandidate> all;
+            for (int x = 0; x < variable->domain_size; x++) {
+                variable->value = x;
+                vector<ParetoCandidate> candidates(1);
+                candidates[0].weight = 0.0;
+                candidates[0].value = 0.0;
+                candidates[0].indices.push_back(x);
+                for (auto f : buckets[t])
+                    add_frontier(candidates, f->table[Variable::getAddress(f->variables)], delta);
+                all.insert(all.end(), candidates.begin(), candidates.end());
+            }
+            prune_frontier(all, delta);
+            for (int c = 0; c < all.size(); c++) {
+                ParetoPoint point;
+                point.weight = all[c].weight;
+                point.value = all[c].value;
+                point.from = message->provenance.size();
+                message->provenance.push_back(all[c].indices);
+                message->table[a].push_back(point);
+            }
+            result.max_frontier = std::max(result.max_frontier, (long long) all.size());
+        }
+        functions.push_back(message);
+        if (message->variables.empty()) {
+            roots.push_back(message);
+            continue;
+        }
+        int first = order.size();
+        for (auto v : message->variables)
+            first = std::min(first, position[v->id]);
+        buckets[first].push_back(message);
+    }
+    // The frontiers of the independent parts of the network are combined into the final one
+    vector<ParetoCandidate> frontier(1);
+    frontier[0].weight = 0.0;
+    frontier[0].value = 0.0;
+    for (auto f : roots)
+        add_frontier(frontier, f->table[0], delta);
+    result.frontier = vector<pair<long double, long double> >(frontier.size());
+    for (int c = 0; c < frontier.size(); c++)
+        result.frontier[c] = make_pair(frontier[c].weight, frontier[c].value);
+    // The point answering each q is decoded through the provenance of the frontiers
+    for (int j = 0; j < logqs.size(); j++) {
+        int best = -1;
+        for (int c = 0; c < frontier.size(); c++) {
+            if (frontier[c].weight <= logqs[j] && frontier[c].value > result.values[j]) {
+                result.values[j] = frontier[c].value;
+                best = c;
+            }
+        }
+        if (best == -1) continue;
+        for (int r = 0; r < roots.size(); r++)
+            decode_point(roots[r], frontier[best].indices[r]);
+        get_assignment(result.assignments[j]);
+    }
+    set_assignment(saved);
+    for (auto f : functions)
+        delete f;
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
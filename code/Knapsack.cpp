@@ -27,8 +27,10 @@
  */
 
 #include "Knapsack.h"
+#include "Profiler.h"
 #include <algorithm>
 #include <iostream>
+#include <limits>
 
 
 bool Item_sorter(Item const &lhs, Item &rhs) {
@@ -40,6 +42,10 @@ void sortBin(Bin &bin) {
 }
 
 void RemoveDominatedItems(Bin &bin_) {
+    // Items of profit -inf hit a zero entry (hard constraint) and can never be chosen
+    bin_.erase(std::remove_if(bin_.begin(), bin_.end(), [](const Item &item) {
+        return item.profit == -std::numeric_limits<long double>::infinity();
+    }), bin_.end());
     if (bin_.empty()) return;
     sortBin(bin_);
     //return;
@@ -54,6 +60,131 @@ void RemoveDominatedItems(Bin &bin_) {
     }
 }
 
+// Keeps the items of a bin that lie on the upper convex hull of (cost, profit).
+// The bin must be sorted by cost with dominated items removed, as done by RemoveDominatedItems.
+void ConvexHull(Bin &bin_) {
+    Bin bin = bin_;
+    bin_ = vector<Item>();
+    for (int i = 0; i < bin.size(); i++) {
+        // Of two items with the same cost only the more profitable one is kept
+        if (!bin_.empty() && bin_.back().cost == bin[i].cost)
+            bin_.pop_back();
+        while (bin_.size() >= 2) {
+            Item &o = bin_[bin_.size() - 2];
+            Item &a = bin_[bin_.size() - 1];
+            long double cross = (a.cost - o.cost) * (bin[i].profit - o.profit) - (a.profit - o.profit) * (bin[i].cost - o.cost);
+            if (cross < 0) break;
+            bin_.pop_back();
+        }
+        bin_.push_back(bin[i]);
+    }
+}
+
+struct Increment {
+    long double cost;
+    long double profit;
+    // Bin of the increment and position in the hull of the item it moves to
+    int bin;
+    int item;
+};
+
+bool Increment_sorter(Increment const &lhs, Increment const &rhs) {
+    return lhs.profit * rhs.cost > rhs.profit * lhs.cost;
+}
+
+// Upper bound on the MCKP over bins [first, hulls.size()) from its LP relaxation.
+// Every bin must be a convex hull produced by ConvexHull. Starting from the cheapest item of
+// each bin, the hull increments are taken in decreasing order of profit per unit cost until
+// the capacity is used up, the last one fractionally. Returns the lowest long double if even
+// the cheapest items exceed max_cost.
+long double lp_bound_MCKP(MCKP &hulls, int first, long double max_cost) {
+    long double total_cost = 0.0;
+    long double total_profit = 0.0;
+    vector<Increment> increments;
+    for (int i = first; i < hulls.size(); i++) {
+        // Every item of the bin violates a hard constraint
+        if (hulls[i].empty())
+            return -1 * std::numeric_limits<long double>::max();
+        total_cost += hulls[i][0].cost;
+        total_profit += hulls[i][0].profit;
+        for (int j = 1; j < hulls[i].size(); j++) {
+            Increment increment;
+            increment.cost = hulls[i][j].cost - hulls[i][j - 1].cost;
+            increment.profit = hulls[i][j].profit - hulls[i][j - 1].profit;
+            increment.bin = i;
+            increment.item = j;
+            increments.push_back(increment);
+        }
+    }
+    if (total_cost > max_cost) {
+        return -1 * std::numeric_limits<long double>::max();
+    }
+    sort(increments.begin(), increments.end(), &Increment_sorter);
+    long double residual = max_cost - total_cost;
+    for (int i = 0; i < increments.size(); i++) {
+        if (increments[i].cost <= residual) {
+            residual -= increments[i].cost;
+            total_profit += increments[i].profit;
+        } else {
+            total_profit += increments[i].profit * (residual / increments[i].cost);
+            break;
+        }
+    }
+    return total_profit;
+}
+
+// Solutions of the MCKP for several capacities at once, along the path of its LP relaxation.
+// Every bin must be a convex hull produced by ConvexHull. Starting from the cheapest item of
+// each bin, the hull increments are taken in decreasing order of profit per unit cost; the
+// solution for a capacity is the longest prefix of this path that fits. profits receives the
+// lowest long double for capacities below the cost of the cheapest items. solutions receives,
+// for every capacity, the position in the original bin of the item selected in each bin.
+void parametric_MCKP(MCKP &hulls, const vector<long double> &max_costs, vector<long double> &profits,
+                     vector<vector<long long> > &solutions) {
+    long double total_cost = 0.0;
+    long double total_profit = 0.0;
+    vector<int> chosen(hulls.size(), 0);
+    vector<Increment> increments;
+    for (int i = 0; i < hulls.size(); i++) {
+        if (hulls[i].empty()) {
+            profits = vector<long double>(max_costs.size(), -1 * std::numeric_limits<long double>::max());
+            solutions = vector<vector<long long> >(max_costs.size(), vector<long long>(hulls.size(), 0));
+            return;
+        }
+        total_cost += hulls[i][0].cost;
+        total_profit += hulls[i][0].profit;
+        for (int j = 1; j < hulls[i].size(); j++) {
+            Increment increment;
+            increment.cost = hulls[i][j].cost - hulls[i][j - 1].cost;
+            increment.profit = hulls[i][j].profit - hulls[i][j - 1].profit;
+            increment.bin = i;
+            increment.item = j;
+            increments.push_back(increment);
+        }
+    }
+    sort(increments.begin(), increments.end(), &Increment_sorter);
+    // Capacities are visited in increasing order so that the path is walked only once
+    vector<int> order(max_costs.size());
+    for (int c = 0; c < order.size(); c++)
+        order[c] = c;
+    sort(order.begin(), order.end(), [&max_costs](int lhs, int rhs) { return max_costs[lhs] < max_costs[rhs]; });
+    profits = vector<long double>(max_costs.size());
+    solutions = vector<vector<long long> >(max_costs.size());
+    int next = 0;
+    for (int c : order) {
+        while (next < increments.size() && total_cost + increments[next].cost <= max_costs[c]) {
+            total_cost += increments[next].cost;
+            total_profit += increments[next].profit;
+            chosen[increments[next].bin] = increments[next].item;
+            next++;
+        }
+        profits[c] = total_cost <= max_costs[c] ? total_profit : -1 * std::numeric_limits<long double>::max();
+        solutions[c] = vector<long long>(hulls.size());
+        for (int i = 0; i < hulls.size(); i++)
+            solutions[c][i] = hulls[i][chosen[i]].pos_in_bin;
+    }
+}
+
 void print_mckp(MCKP &mckp) {
     cout << "Num bins = " << mckp.size() << endl;
     for (int i = 0; i < mckp.size(); i++) {
@@ -65,10 +196,13 @@ void print_mckp(MCKP &mckp) {
     }
 }
 
-// Returns the current best value and stores the best solution so far in solution
+// Returns the current best value and stores the best solution so far in solution. The local
+// search draws from generator, or from rand() if it is null (only on one thread at a time)
 long double
 greedy_solve_MCKP(vector<vector<long double> > &weights, vector<vector<long double> > &profits, long double max_cost,
-                 vector<int> &solution) {
+                 vector<long long> &solution, std::mt19937 *generator) {
+    PROFILE_SCOPE("greedy_solve_MCKP");
+    PROFILE_COUNT(PROFILE_MCKP_CALLS, 1);
     // Begin: Construct the MCKP from profits and weights
     if (weights.size() != profits.size()) {
         cerr << "Mismatch in the number of Bins\n";
@@ -81,7 +215,7 @@ greedy_solve_MCKP(vector<vector<long double> > &weights, vector<vector<long doub
             cerr << "Mismatch in the number of items in Bin " << i << "\n";
             exit(-1);
         }
-        for (int j = 0; j < weights[i].size(); j++) {
+        for (long long j = 0; j < weights[i].size(); j++) {
             mckp[i][j].profit = profits[i][j];
             mckp[i][j].cost = weights[i][j];
             mckp[i][j].pos_in_bin = j;
@@ -97,6 +231,12 @@ greedy_solve_MCKP(vector<vector<long double> > &weights, vector<vector<long doub
     vector<int> multi_item_bin_ids;
     for (int i = 0; i < num_bins; i++) {
         RemoveDominatedItems(mckp[i]);
+        // Every item of the bin violates a hard constraint
+        if (mckp[i].empty()) {
+            solution = vector<long long>(num_bins, 0);
+            return -1 * std::numeric_limits<long double>::max();
+        }
+        PROFILE_COUNT(PROFILE_MCKP_ITEMS, mckp[i].size());
         if ((int) mckp[i].size() > 1) {
             multi_item_bin_ids.emplace_back(i);
         }
@@ -106,16 +246,19 @@ greedy_solve_MCKP(vector<vector<long double> > &weights, vector<vector<long doub
     vector<Item> current_solution(num_bins);
     long double current_total_profit = 0.0;
     long double current_total_cost = 0.0;
-    solution = vector<int>(num_bins);
+    solution = vector<long long>(num_bins);
     vector<int> current_solution_index(num_bins, 0);
     for (int i = 0; i < num_bins; i++) {
         current_solution[i] = mckp[i][0];
         current_total_cost += mckp[i][0].cost;
         current_total_profit += mckp[i][0].profit;
-        // Check if problem is infeasible
-        if (current_total_cost > max_cost) {
-            return -1 * std::numeric_limits<long double>::max();
-        }
+    }
+    // Check if problem is infeasible. Costs are log-weights and may be negative, so only the
+    // total of the cheapest items decides; the solution is then the cheapest completion
+    if (current_total_cost > max_cost) {
+        for (int i = 0; i < num_bins; i++)
+            solution[i] = mckp[i][0].pos_in_bin;
+        return -1 * std::numeric_limits<long double>::max();
     }
 
     for(int i=0;i<num_bins;i++){
@@ -142,7 +285,8 @@ greedy_solve_MCKP(vector<vector<long double> > &weights, vector<vector<long doub
     // Step 3. Perform Local Search
     // Step 2. Construct a greedy solution multiple times by replacing low profit items with high profit items
     // Fill up residual capacity with the bin where the iteration terminates
-    for(int num_restarts=0;num_restarts<100;num_restarts++) {
+    // Nothing to improve if every bin was reduced to a single item
+    for(int num_restarts=0;num_restarts<100 && !multi_item_bin_ids.empty();num_restarts++) {
         current_total_profit = 0.0;
         current_total_cost = 0.0;
         current_solution_index=vector<int>(num_bins, 0);
@@ -152,7 +296,8 @@ greedy_solve_MCKP(vector<vector<long double> > &weights, vector<vector<long doub
             current_total_profit += mckp[i][0].profit;
         }
         for (int iter = 0; iter < 1000; iter++) {
-            int i = multi_item_bin_ids[rand() % multi_item_bin_ids.size()];
+            unsigned int r = generator != nullptr ? (*generator)() : (unsigned int) rand();
+            int i = multi_item_bin_ids[r % multi_item_bin_ids.size()];
             int mi = current_solution_index[i];
             for (int j = 0; j < mckp[i].size(); j++) {
                 if (j == mi) continue;
@@ -30,13 +30,14 @@
 #define CMPE_KNAPSACK_H
 
 #include <vector>
+#include <random>
 using namespace std;
 
 struct Item
 {
     long double profit;
     long double cost;
-    int pos_in_bin;
+    long long pos_in_bin;
 };
 
 typedef vector<Item> Bin;
@@ -27,25 +27,145 @@
  */
 
 #include "MN.h"
+#include "Knapsack.h"
+#include "Profiler.h"
+#include "Telemetry.h"
 #include <fstream>
+#include <sstream>
+#include <iomanip>
 #include <vector>
 #include <set>
 #include <cmath>
 #include <ctime>
 #include <algorithm>
 #include <iterator>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
 
 
 
 
 extern long double
 greedy_solve_MCKP(vector<vector<long double> > &weights, vector<vector<long double> > &profits, long double max_cost,
-                 vector<int> &solution);
+                 vector<long long> &solution, std::mt19937 *generator = nullptr);
+extern void RemoveDominatedItems(Bin &bin_);
+extern void ConvexHull(Bin &bin_);
+extern void parametric_MCKP(MCKP &hulls, const vector<long double> &max_costs, vector<long double> &profits,
+                            vector<vector<long long> > &solutions);
 
+TableData::TableData(vector<long double>&& values_) : values(std::move(values_)), size(values.size()), min(0.0), max(0.0), forbidden(0)
+{
+    if (!values.empty()) {
+        min = *std::min_element(values.begin(), values.end());
+        max = *std::max_element(values.begin(), values.end());
+    }
+    forbidden = std::count(values.begin(), values.end(), -std::numeric_limits<long double>::infinity());
+    if (size < compress_min_size)
+        return;
+    long long runs = 1;
+    for (long long i = 1; i < size; i++)
+        if (values[i] != values[i - 1])
+            runs++;
+    if (runs * (sizeof(long long) + sizeof(long double)) > compress_ratio * size * sizeof(long double))
+        return;
+    for (long long i = 0; i < size; i++) {
+        if (i == 0 || values[i] != values[i - 1]) {
+            run_starts.push_back(i);
+            run_values.push_back(values[i]);
+        }
+    }
+    vector<long double>().swap(values);
+}
 
-// Read the Markov network
-void MN::readMN(string filename)
+// Tables are equal if their entries are: equal entries give the same (dense or compressed) form
+bool TableData::operator==(const TableData& other) const
 {
+    return size == other.size && values == other.values && run_starts == other.run_starts && run_values == other.run_values;
+}
+
+size_t TableData::hash() const
+{
+    size_t hash = size;
+    const vector<long double>& entries = compressed() ? run_values : values;
+    for (auto value : entries)
+        hash ^= std::hash<long double>()(value) + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+    for (auto start : run_starts)
+        hash ^= std::hash<long long>()(start) + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+    return hash;
+}
+
+Table TablePool::intern(vector<long double>&& values)
+{
+    return intern(Table(std::move(values)));
+}
+
+Table TablePool::intern(const Table& table)
+{
+    if (!table.data)
+        return table;
+    vector<std::weak_ptr<const TableData> >& bucket = buckets[table.data->hash()];
+    for (int i = 0; i < bucket.size(); i++) {
+        std::shared_ptr<const TableData> data = bucket[i].lock();
+        if (!data) {
+            // Drop the tables no potential uses anymore
+            bucket[i] = bucket.back();
+            bucket.pop_back();
+            i--;
+        } else if (*data == *table.data) {
+            return Table(data);
+        }
+    }
+    bucket.push_back(table.data);
+    return table;
+}
+
+// Shares the tables of the potentials of this network and of mn_c (which may be this network)
+// that have the same entries, and prints how much sharing and compression save
+void MN::share_tables(MN& mn_c)
+{
+    vector<MN*> networks(1, this);
+    if (&mn_c != this)
+        networks.push_back(&mn_c);
+    long long num_potentials = 0, entries = 0, shared_entries = 0, stored = 0;
+    int compressed = 0;
+    set<const TableData*> distinct;
+    for (auto network : networks) {
+        for (auto potential : network->potentials) {
+            potential->table = table_pool.intern(potential->table);
+            num_potentials++;
+            entries += potential->table.size();
+        }
+    }
+    long references = 0;
+    for (auto network : networks) {
+        for (auto potential : network->potentials) {
+            if (distinct.insert(potential->table.data.get()).second) {
+                shared_entries += potential->table.size();
+                references = std::max(references, potential->table.references());
+                if (potential->table.compressed()) {
+                    compressed++;
+                    stored += potential->table.data->run_starts.size();
+                } else {
+                    stored += potential->table.size();
+                }
+            }
+        }
+    }
+    cout << "Tables: potentials = " << num_potentials << ", distinct tables = " << distinct.size()
+         << ", most shared table = " << references << " potentials, entries = " << shared_entries
+         << " (" << entries << " unshared), compressed tables = " << compressed
+         << ", entries and runs stored = " << stored << endl;
+}
+
+// Read the Markov network, conditioned on the evidence file if one is given
+void MN::readMN(string filename, string evidence_filename)
+{
+    PROFILE_SCOPE("readMN");
     ifstream infile(filename);
     int num_variables;
     string tmp_string;
@@ -80,30 +200,591 @@ void MN::readMN(string filename)
     potentials = vector<Potential*>(num_functions);
     //srand(100000000L);
     for (int i = 0; i < num_functions; i++) {
-        int num_entries;
+        long long num_entries;
         infile >> num_entries;
         potentials[i] = new Potential();
         potentials[i]->variables = scope[i];
-        int num_values = Variable::getDomainSize(scope[i]);
-        potentials[i]->table = vector<long double>(num_values);
-        for (int j = 0; j < num_values; j++) {
+        long long num_values = Variable::getDomainSize(scope[i]);
+        vector<long double> table(num_values);
+        for (long long j = 0; j < num_values; j++) {
             Variable::setAddress(scope[i], j);
             long double value;
             infile >> value;
-            int entry = Variable::getAddress(potentials[i]->variables);
-            if (value > 0.0)
-                potentials[i]->table[entry] = log(value);
+            long long entry = Variable::getAddress(potentials[i]->variables);
+            // Zeros are hard constraints, see hard_constraints
+            if (value >= 0.0)
+                table[entry] = value > 0.0 ? log(value) : -std::numeric_limits<long double>::infinity();
             else {
-                cerr << "Cannot handle zeros: Log-potentials\n";
+                cerr << "Cannot handle negative entries\n";
                 exit(-1);
             }
         }
+        // Potentials with the same entries share one table
+        potentials[i]->table = table_pool.intern(std::move(table));
     }
     infile.close();
+    if (!evidence_filename.empty())
+        condition(read_evidence(evidence_filename));
+}
+
+// Reads a UAI evidence file: the number of observed variables followed by (variable, value)
+// pairs, optionally preceded by the number of samples (1) as in older UAI competitions
+vector<int> MN::read_evidence(string filename)
+{
+    ifstream infile(filename);
+    if (!infile.good()) {
+        cerr << "Could not open evidence file " << filename << "\n";
+        exit(-1);
+    }
+    vector<long long> tokens;
+    long long token;
+    while (infile >> token)
+        tokens.push_back(token);
+    infile.close();
+    int start = 1;
+    if (!tokens.empty() && tokens.size() != 1 + 2 * tokens[0]) {
+        if (tokens[0] != 1 || tokens.size() < 2 || tokens.size() != 2 + 2 * tokens[1]) {
+            cerr << "Not an evidence file with a single sample\n";
+            exit(-1);
+        }
+        start = 2;
+    }
+    vector<int> evidence_(variables.size(), -1);
+    for (int i = start; i + 1 < tokens.size(); i += 2) {
+        if (tokens[i] < 0 || tokens[i] >= variables.size() || tokens[i + 1] < 0
+            || tokens[i + 1] >= variables[tokens[i]]->domain_size) {
+            cerr << "Evidence " << tokens[i] << " " << tokens[i + 1] << " does not match the Markov network\n";
+            exit(-1);
+        }
+        evidence_[tokens[i]] = tokens[i + 1];
+    }
+    return evidence_;
+}
+
+// Restrict every potential to the observed values, fold the potentials left without variables
+// into another potential and remove the observed variables, renumbering the others
+void MN::condition(const vector<int>& evidence_)
+{
+    if (uai_variables.empty())
+        uai_variables = variables;
+    evidence = evidence_;
+    for (int i = 0; i < uai_variables.size(); i++) {
+        uai_variables[i]->id = i;
+        if (evidence[i] >= 0)
+            uai_variables[i]->value = evidence[i];
+    }
+    long double constant = 0.0;
+    vector<Potential*> conditioned;
+    for (auto potential : potentials) {
+        vector<Variable*> scope;
+        for (auto variable : potential->variables)
+            if (evidence[variable->id] < 0)
+                scope.push_back(variable);
+        if (scope.size() < potential->variables.size()) {
+            vector<long double> table(Variable::getDomainSize(scope));
+            for (long long j = 0; j < table.size(); j++) {
+                Variable::setAddress(scope, j);
+                table[j] = potential->table[Variable::getAddress(potential->variables)];
+            }
+            potential->variables = scope;
+            potential->table = table;
+        }
+        if (scope.empty()) {
+            constant += potential->table[0];
+            delete potential;
+        } else {
+            conditioned.push_back(potential);
+        }
+    }
+    if (conditioned.empty()) {
+        cerr << "Every variable of the Markov network is observed\n";
+        exit(-1);
+    }
+    vector<long double> first(conditioned[0]->table.values());
+    for (auto& value : first)
+        value += constant;
+    conditioned[0]->table = std::move(first);
+    potentials = conditioned;
+    variables.clear();
+    for (auto variable : uai_variables) {
+        if (evidence[variable->id] < 0)
+            variables.push_back(variable);
+    }
+    for (int i = 0; i < variables.size(); i++)
+        variables[i]->id = i;
+}
+
+// Assignment to the variables of the UAI file from an assignment to the unobserved variables
+void MN::expand_assignment(const vector<int>& values_, vector<int>& uai_values)
+{
+    // Values in the order of the variables before reorder
+    vector<int> values(values_);
+    for (int v = 0; v < variable_order.size(); v++)
+        values[variable_order[v]] = values_[v];
+    if (uai_variables.empty()) {
+        uai_values = values;
+        return;
+    }
+    uai_values = evidence;
+    int j = 0;
+    for (int i = 0; i < uai_values.size(); i++) {
+        if (uai_values[i] < 0) {
+            uai_values[i] = value_maps.empty() || value_maps[i].empty() ? values[j] : value_maps[i][values[j]];
+            j++;
+        }
+    }
+}
+
+// Assignment to the unobserved variables; false if the values of the UAI file contradict the
+// evidence or take a value removed from a domain
+bool MN::reduce_assignment(const vector<int>& uai_values, vector<int>& values)
+{
+    // Variables in their order before reorder
+    vector<Variable*> previous(variables);
+    for (int v = 0; v < variable_order.size(); v++)
+        previous[variable_order[v]] = variables[v];
+    values.clear();
+    for (int i = 0, j = 0; i < uai_values.size(); i++) {
+        if (!uai_variables.empty() && evidence[i] >= 0) {
+            if (uai_values[i] != evidence[i])
+                return false;
+            continue;
+        }
+        if (j >= previous.size())
+            return false;
+        if (value_maps.empty() || value_maps[i].empty()) {
+            if (uai_values[i] < 0 || uai_values[i] >= previous[j]->domain_size)
+                return false;
+            values.push_back(uai_values[i]);
+        } else {
+            vector<int>& map = value_maps[i];
+            vector<int>::iterator it = std::find(map.begin(), map.end(), uai_values[i]);
+            if (it == map.end())
+                return false;
+            values.push_back(it - map.begin());
+        }
+        j++;
+    }
+    if (!variable_order.empty()) {
+        vector<int> reordered(values.size());
+        for (int v = 0; v < variable_order.size(); v++)
+            reordered[v] = values[variable_order[v]];
+        values.swap(reordered);
+    }
+    return true;
+}
+
+// Renumbers the variables in reverse Cuthill-McKee order of the primal graph, so that variables
+// sharing potentials get close ids, and moves them to one contiguous block of memory; the pairs
+// of potentials of this network and mn_c (which may be this network) are then sorted by their
+// first and last variables, which groups the potentials of a region. variable_order and
+// potential_order keep the previous indices, used by the assignment files and MPS names
+void MN::reorder(MN& mn_c)
+{
+    int n = variables.size();
+    vector<set<int> > graph = primal_graph();
+    vector<int> degree(n);
+    for (int v = 0; v < n; v++)
+        degree[v] = graph[v].size();
+    // Cuthill-McKee: breadth-first search from a vertex of smallest degree in every connected
+    // component, visiting neighbours by increasing degree
+    vector<int> order;
+    vector<bool> visited(n, false);
+    vector<int> by_degree(n);
+    for (int v = 0; v < n; v++)
+        by_degree[v] = v;
+    std::stable_sort(by_degree.begin(), by_degree.end(), [&](int a, int b) { return degree[a] < degree[b]; });
+    for (int start : by_degree) {
+        if (visited[start])
+            continue;
+        visited[start] = true;
+        order.push_back(start);
+        for (int next = order.size() - 1; next < order.size(); next++) {
+            vector<int> neighbours;
+            for (int u : graph[order[next]])
+                if (!visited[u])
+                    neighbours.push_back(u);
+            std::stable_sort(neighbours.begin(), neighbours.end(), [&](int a, int b) { return degree[a] < degree[b]; });
+            for (int u : neighbours) {
+                visited[u] = true;
+                order.push_back(u);
+            }
+        }
+    }
+    std::reverse(order.begin(), order.end());
+    // Composed with any previous reordering, so that the indices refer to the file read
+    vector<int> previous_order(variable_order);
+    variable_order = order;
+    for (int v = 0; v < n && !previous_order.empty(); v++)
+        variable_order[v] = previous_order[order[v]];
+    Variable* block = new Variable[n];
+    vector<Variable*> moved(n);
+    for (int v = 0; v < n; v++) {
+        block[v] = *variables[order[v]];
+        block[v].id = v;
+        moved[order[v]] = &block[v];
+    }
+    vector<MN*> networks(1, this);
+    if (&mn_c != this)
+        networks.push_back(&mn_c);
+    for (auto network : networks)
+        for (auto potential : network->potentials)
+            for (auto& variable : potential->variables)
+                variable = moved[variable->id];
+    // Observed variables of the UAI file stay where they are
+    for (auto network : networks) {
+        for (auto& variable : network->uai_variables) {
+            if (variable->id >= 0 && variable->id < n && variables[variable->id] == variable)
+                variable = moved[variable->id];
+        }
+    }
+    for (int v = 0; v < n; v++)
+        variables[v] = &block[v];
+    for (auto network : networks)
+        network->variables = variables;
+    // Pairs of potentials by their smallest and largest variables
+    int m = potentials.size();
+    vector<std::pair<int, int> > extent(m, std::make_pair(n, -1));
+    for (int i = 0; i < m; i++) {
+        for (auto network : networks) {
+            for (auto variable : network->potentials[i]->variables) {
+                extent[i].first = std::min(extent[i].first, variable->id);
+                extent[i].second = std::max(extent[i].second, variable->id);
+            }
+        }
+    }
+    vector<int> potential_permutation(m);
+    for (int i = 0; i < m; i++)
+        potential_permutation[i] = i;
+    std::stable_sort(potential_permutation.begin(), potential_permutation.end(), [&](int a, int b) { return extent[a] < extent[b]; });
+    vector<int> previous_potentials(potential_order);
+    potential_order = potential_permutation;
+    for (int i = 0; i < m && !previous_potentials.empty(); i++)
+        potential_order[i] = previous_potentials[potential_permutation[i]];
+    for (auto network : networks) {
+        vector<Potential*> sorted(m);
+        for (int i = 0; i < m; i++)
+            sorted[i] = network->potentials[potential_permutation[i]];
+        network->potentials = sorted;
+    }
+}
+
+// Keeps the values of every variable marked in alive, in this network and in mn_c (which may be
+// this network): tables are re-indexed over the remaining values, variables left with a single
+// value become evidence and are removed, and the others are renumbered
+void MN::restrict_domains(MN& mn_c, const vector<vector<bool> >& alive)
+{
+    if (uai_variables.empty()) {
+        uai_variables = variables;
+        evidence = vector<int>(variables.size(), -1);
+    }
+    if (value_maps.empty())
+        value_maps = vector<vector<int> >(uai_variables.size());
+    vector<vector<int> > kept(variables.size());
+    for (int v = 0; v < variables.size(); v++)
+        for (int d = 0; d < variables[v]->domain_size; d++)
+            if (alive[v][d])
+                kept[v].push_back(d);
+    vector<MN*> networks(1, this);
+    if (&mn_c != this)
+        networks.push_back(&mn_c);
+    for (auto network : networks) {
+        for (auto potential : network->potentials) {
+            vector<Variable*> scope;
+            vector<long long> strides;
+            long long stride = 1;
+            long long fixed = 0;
+            for (auto variable : potential->variables) {
+                if (kept[variable->id].size() > 1) {
+                    scope.push_back(variable);
+                    strides.push_back(stride);
+                } else {
+                    fixed += stride * kept[variable->id][0];
+                }
+                stride *= variable->domain_size;
+            }
+            long long size = 1;
+            for (auto variable : scope)
+                size *= kept[variable->id].size();
+            // Entry of the old table for every combination of the remaining values
+            vector<long double> table(size);
+            vector<int> digits(scope.size(), 0);
+            for (long long a = 0; a < size; a++) {
+                long long address = fixed;
+                for (int l = 0; l < scope.size(); l++)
+                    address += strides[l] * kept[scope[l]->id][digits[l]];
+                table[a] = potential->table[address];
+                for (int l = 0; l < scope.size() && ++digits[l] == kept[scope[l]->id].size(); l++)
+                    digits[l] = 0;
+            }
+            potential->variables = scope;
+            potential->table = table;
+        }
+    }
+    // Pairs left without variables are added to the first remaining pair, as by condition
+    vector<bool> empty(potentials.size());
+    int first = -1;
+    for (int i = 0; i < potentials.size(); i++) {
+        empty[i] = potentials[i]->variables.empty() && mn_c.potentials[i]->variables.empty();
+        if (!empty[i] && first < 0)
+            first = i;
+    }
+    if (first < 0) {
+        cerr << "Every variable of the Markov network is fixed\n";
+        exit(-1);
+    }
+    for (auto network : networks) {
+        vector<Potential*> restricted;
+        for (int i = 0; i < network->potentials.size(); i++) {
+            Potential* potential = network->potentials[i];
+            if (!empty[i]) {
+                restricted.push_back(potential);
+                continue;
+            }
+            vector<long double> table(network->potentials[first]->table.values());
+            for (auto& value : table)
+                value += potential->table[0];
+            network->potentials[first]->table = std::move(table);
+            delete potential;
+        }
+        network->potentials = restricted;
+    }
+    vector<Variable*> remaining;
+    for (int i = 0, v = 0; i < uai_variables.size(); i++) {
+        if (evidence[i] >= 0)
+            continue;
+        vector<int> map;
+        for (auto d : kept[v])
+            map.push_back(value_maps[i].empty() ? d : value_maps[i][d]);
+        if (map.size() == 1) {
+            evidence[i] = map[0];
+        } else {
+            value_maps[i] = map;
+            variables[v]->domain_size = map.size();
+            remaining.push_back(variables[v]);
+        }
+        v++;
+    }
+    for (auto network : networks)
+        network->variables = remaining;
+    for (int i = 0; i < remaining.size(); i++)
+        remaining[i]->id = i;
+}
+
+// Zero entries are read as -inf log-potentials: their assignments are forbidden. Those of this
+// (weight) network are moved to the value network mn_c, where maximization avoids them, and
+// replaced by the largest weight of their potential, so weights stay finite. Generalized arc
+// consistency over the forbidden entries then removes the values without support
+void MN::hard_constraints(MN& mn_c)
+{
+    const long double minus_infinity = -std::numeric_limits<long double>::infinity();
+    long long zeros = 0;
+    if (&mn_c != this) {
+        int n = potentials.size();
+        for (int i = 0; i < n; i++) {
+            Potential* potential = potentials[i];
+            if (potential->table.forbidden() == 0)
+                continue;
+            long double largest = potential->table.max();
+            if (largest == minus_infinity)
+                largest = 0.0;
+            set<Variable*> scope(potential->variables.begin(), potential->variables.end());
+            Potential* target = mn_c.potentials[i];
+            // A value potential over other variables gets a new pair of potentials
+            if (set<Variable*>(target->variables.begin(), target->variables.end()) != scope) {
+                Potential* weights = new Potential();
+                weights->variables = potential->variables;
+                weights->table = vector<long double>(potential->table.size(), 0.0);
+                potentials.push_back(weights);
+                target = new Potential();
+                target->variables = potential->variables;
+                target->table = vector<long double>(potential->table.size(), 0.0);
+                mn_c.potentials.push_back(target);
+            }
+            vector<long double> weight_table(potential->table.values());
+            vector<long double> value_table(target->table.values());
+            for (long long e = 0; e < weight_table.size(); e++) {
+                if (weight_table[e] != minus_infinity)
+                    continue;
+                Variable::setAddress(potential->variables, e);
+                value_table[Variable::getAddress(target->variables)] = minus_infinity;
+                weight_table[e] = largest;
+            }
+            potential->table = std::move(weight_table);
+            target->table = std::move(value_table);
+        }
+    }
+    vector<int> hard;
+    vector<vector<int> > containing(variables.size());
+    for (int i = 0; i < mn_c.potentials.size(); i++) {
+        long long count = mn_c.potentials[i]->table.forbidden();
+        zeros += count;
+        if (count == 0)
+            continue;
+        hard.push_back(i);
+        for (auto variable : mn_c.potentials[i]->variables)
+            containing[variable->id].push_back(i);
+    }
+    if (hard.empty())
+        return;
+    vector<vector<bool> > alive(variables.size());
+    for (int v = 0; v < variables.size(); v++)
+        alive[v] = vector<bool>(variables[v]->domain_size, true);
+    vector<bool> queued(mn_c.potentials.size(), false);
+    std::deque<int> queue(hard.begin(), hard.end());
+    for (auto i : hard)
+        queued[i] = true;
+    long long removed = 0;
+    while (!queue.empty()) {
+        Potential* potential = mn_c.potentials[queue.front()];
+        queued[queue.front()] = false;
+        queue.pop_front();
+        vector<Variable*>& scope = potential->variables;
+        vector<vector<bool> > supported(scope.size());
+        for (int l = 0; l < scope.size(); l++)
+            supported[l] = vector<bool>(scope[l]->domain_size, false);
+        for (long long e = 0; e < potential->table.size(); e++) {
+            if (potential->table[e] == minus_infinity)
+                continue;
+            Variable::setAddress(scope, e);
+            bool valid = true;
+            for (int l = 0; l < scope.size() && valid; l++)
+                valid = alive[scope[l]->id][scope[l]->value];
+            if (!valid)
+                continue;
+            for (int l = 0; l < scope.size(); l++)
+                supported[l][scope[l]->value] = true;
+        }
+        for (int l = 0; l < scope.size(); l++) {
+            int v = scope[l]->id;
+            bool changed = false, empty = true;
+            for (int d = 0; d < scope[l]->domain_size; d++) {
+                if (alive[v][d] && !supported[l][d]) {
+                    alive[v][d] = false;
+                    changed = true;
+                    removed++;
+                }
+                empty = empty && !alive[v][d];
+            }
+            if (empty) {
+                cerr << "The zero entries leave no assignment with positive probability\n";
+                exit(-1);
+            }
+            if (!changed)
+                continue;
+            for (auto i : containing[v]) {
+                if (!queued[i] && mn_c.potentials[i] != potential) {
+                    queued[i] = true;
+                    queue.push_back(i);
+                }
+            }
+        }
+    }
+    int num_variables = variables.size();
+    if (removed > 0)
+        restrict_domains(mn_c, alive);
+    cout << "Hard constraints: zero entries = " << zeros << ", values removed = " << removed
+         << ", variables fixed = " << num_variables - variables.size() << endl;
+}
+
+// Presolve of a pair of networks whose i-th potentials go together (mn_c may be this network).
+// A pair of potentials over a set of variables contained in the scope of another pair is added
+// to that pair in both networks at once, which also merges potentials over the same variables;
+// pairs constant over their scope are added, as a scalar, to one of the remaining potentials.
+// A pair whose two potentials have different scopes is only folded if constant
+void MN::presolve(MN& mn_c)
+{
+    vector<MN*> networks(1, this);
+    if (&mn_c != this)
+        networks.push_back(&mn_c);
+    int n = potentials.size();
+    vector<set<int> > scopes(n);
+    vector<bool> eligible(n, true), constant(n, true);
+    for (int i = 0; i < n; i++) {
+        for (auto variable : potentials[i]->variables)
+            scopes[i].insert(variable->id);
+        for (auto network : networks) {
+            set<int> scope;
+            for (auto variable : network->potentials[i]->variables)
+                scope.insert(variable->id);
+            eligible[i] = eligible[i] && scope == scopes[i];
+            const Table& table = network->potentials[i]->table;
+            for (auto value : table)
+                constant[i] = constant[i] && value == table[0];
+        }
+    }
+    // Adds pair i to pair a; the scope of i is contained in the scope of a unless i is constant
+    auto absorb = [&](int i, int a) {
+        for (auto network : networks) {
+            Potential* from = network->potentials[i];
+            Potential* to = network->potentials[a];
+            vector<long double> table(to->table.values());
+            for (long long e = 0; e < table.size(); e++) {
+                Variable::setAddress(to->variables, e);
+                table[e] += constant[i] ? from->table[0] : from->table[Variable::getAddress(from->variables)];
+            }
+            to->table = std::move(table);
+        }
+    };
+    // Larger scopes first so that every pair meets the pairs that may contain it before itself
+    vector<int> order;
+    for (int i = 0; i < n; i++)
+        if (eligible[i] && !constant[i])
+            order.push_back(i);
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return scopes[a].size() > scopes[b].size(); });
+    vector<bool> kept(n, true);
+    vector<vector<int> > containing(variables.size());
+    int merged = 0, absorbed = 0, folded = 0;
+    for (auto i : order) {
+        int target = -1;
+        for (auto a : containing[*scopes[i].begin()]) {
+            if (std::includes(scopes[a].begin(), scopes[a].end(), scopes[i].begin(), scopes[i].end())) {
+                target = a;
+                break;
+            }
+        }
+        if (target < 0) {
+            for (auto v : scopes[i])
+                containing[v].push_back(i);
+        } else {
+            absorb(i, target);
+            kept[i] = false;
+            (scopes[i].size() == scopes[target].size() ? merged : absorbed)++;
+        }
+    }
+    int target = -1;
+    for (int i = 0; i < n && target < 0; i++)
+        if (kept[i] && !constant[i])
+            target = i;
+    for (int i = 0; i < n; i++) {
+        if (constant[i] && i != target) {
+            // Every pair is constant: the first one is kept
+            if (target < 0) {
+                target = i;
+                continue;
+            }
+            absorb(i, target);
+            kept[i] = false;
+            folded++;
+        }
+    }
+    for (auto network : networks) {
+        vector<Potential*> remaining;
+        for (int i = 0; i < n; i++) {
+            if (kept[i])
+                remaining.push_back(network->potentials[i]);
+            else
+                delete network->potentials[i];
+        }
+        network->potentials = remaining;
+    }
+    cout << "Presolve: potentials = " << n << " -> " << potentials.size() << " (merged " << merged << ", absorbed "
+         << absorbed << ", constant " << folded << ")" << endl;
 }
 
 void MN::readMN2(string filename,MN& mn1)
 {
+    PROFILE_SCOPE("readMN2");
     ifstream infile(filename);
     int num_variables;
     string tmp_string;
@@ -114,13 +795,15 @@ void MN::readMN2(string filename,MN& mn1)
         return;
     }
     infile >> num_variables;
-    if(num_variables!=mn1.variables.size()){
+    // The file is over the variables of the UAI file of mn1, observed or not
+    const vector<Variable*>& uai_variables_ = mn1.uai_variables.empty() ? mn1.variables : mn1.uai_variables;
+    if(num_variables!=uai_variables_.size()){
         cerr << "Markov networks do not match in number of variables\n";
         exit(-1);
         return;
     }
     // Read domains
-    variables = mn1.variables;
+    variables = uai_variables_;
     for (int i = 0; i < num_variables; i++) {
         int domain_size;
         infile >> domain_size;
@@ -147,33 +830,35 @@ void MN::readMN2(string filename,MN& mn1)
     potentials = vector<Potential*>(num_functions);
     //srand(100000000L);
     for (int i = 0; i < num_functions; i++) {
-        int num_entries;
+        long long num_entries;
         infile >> num_entries;
         potentials[i] = new Potential();
         potentials[i]->variables = scope[i];
-        int num_values = Variable::getDomainSize(scope[i]);
-        potentials[i]->table = vector<long double>(num_values);
-        for (int j = 0; j < num_values; j++) {
+        long long num_values = Variable::getDomainSize(scope[i]);
+        vector<long double> table(num_values);
+        for (long long j = 0; j < num_values; j++) {
             Variable::setAddress(scope[i], j);
             long double value;
             infile >> value;
-            int entry = Variable::getAddress(potentials[i]->variables);
-            if (value > 0.0)
-                potentials[i]->table[entry] = log(value);
+            long long entry = Variable::getAddress(potentials[i]->variables);
+            if (value >= 0.0)
+                table[entry] = value > 0.0 ? log(value) : -std::numeric_limits<long double>::infinity();
             else {
-                cerr << "Cannot handle zeros: Log-potentials\n";
+                cerr << "Cannot handle negative entries\n";
                 exit(-1);
             }
         }
+        // Potentials with the same entries share one table
+        potentials[i]->table = mn1.table_pool.intern(std::move(table));
     }
     infile.close();
+    if (!mn1.evidence.empty())
+        condition(mn1.evidence);
 }
-vector <set<int>> MN::findKseparator(int k, vector<Variable*>& cut_variables)
+// Primal (interaction) graph: two variables are adjacent if they appear together in a potential
+vector <set<int>> MN::primal_graph()
 {
-    cut_variables = vector<Variable*>();
     vector < set<int> > graph(variables.size());
-    vector<int> degree(variables.size(), 0);
-    //Construct the graph
     for (auto & potential : potentials) {
         for (int j = 0; j < potential->variables.size(); j++) {
             int var1_id = potential->variables[j]->id;
@@ -184,6 +869,16 @@ vector <set<int>> MN::findKseparator(int k, vector<Variable*>& cut_variables)
             }
         }
     }
+    return graph;
+}
+
+vector <set<int>> MN::findKseparator(int k, vector<Variable*>& cut_variables)
+{
+    PROFILE_SCOPE("findKseparator");
+    cut_variables = vector<Variable*>();
+    vector<int> degree(variables.size(), 0);
+    //Construct the graph
+    vector < set<int> > graph = primal_graph();
     // Initialize the degrees
     for (int i = 0; i < graph.size(); i++) {
         degree[i] = graph[i].size();
@@ -321,6 +1016,7 @@ void MN::DFSUtil(int v, bool visited[], vector <set<int>> adj, vector <set<int>>
 
 vector <set<int>> MN::generate_buckets(vector <set<int>>& components)
 {
+    PROFILE_SCOPE("generate_buckets");
     vector <set<int>> buckets (components.size()+1);
     set<int> cut_vars;
     vector <set<int>> potential_vars (potentials.size());
@@ -359,14 +1055,14 @@ bool MN::knapsack_greedy(long double logq, vector<Potential>& functions, vector<
 
     //generating weights
     vector<vector<long double>> weights(functions.size());
-    vector<int> assignment;
+    vector<long long> assignment;
     for(int i=0;i<functions.size();i++){
-        weights[i]=functions[i].table;
+        weights[i]=functions[i].table.values();
     }
     //generating values
     vector<vector<long double>> values(functions_c.size());
     for(int i=0;i<functions_c.size();i++){
-        values[i]=functions_c[i].table;
+        values[i]=functions_c[i].table.values();
     }
     best_prob=greedy_solve_MCKP(weights,values,logq,assignment);
 
@@ -380,161 +1076,1334 @@ bool MN::knapsack_greedy(long double logq, vector<Potential>& functions, vector<
     return true;
 }
 
-long double MN::run_experiments_neurips(MN& mn_c, long double logq, int k, ostream& out1, int max_time){
-    //creating a graphical model from the original one
-    //Uncomment the following line if you want to generate knapsack networks randomly
-    //this->create_knapsack(mn_c);
-    //MN_constructed mn_c(potentials, variables);
-    long double best_prob=0;
-    long double greedy_output;
-    vector<int> assignment(variables.size());
-    vector<int> best_assignment(variables.size());
-    out1.precision(20);
-    //run for all values less than k
-    for (int h = 1; h < k+1; h +=2) {
-        std::time_t start_time = std::time(nullptr);
-        std::time_t write_time = std::time(nullptr);
-        //initial with the worst answer
-        best_prob = -1 * std::numeric_limits<long double>::max();
-        vector<Variable*> cut_variables;
-        vector <set<int>> components;
-        components = findKseparator(h,cut_variables);
-        vector <set<int>> buckets;
-        buckets = generate_buckets(components);
-        cout<<"Statistics:"<<endl;
-        cout<<"K = "<<h<<endl;
-        cout<<"Number of Variables in the K-separator = "<<cut_variables.size()<<endl;
-        cout<<"Number of components = "<<buckets.size()-1<<endl;
-        for (int i = 0; i<buckets.size()-1; i++){
-            cout<<"number of variables in component "<<i+1<<" "<<components[i].size()<<endl;
+void CutCache::init(const vector<Variable*>& cut_variables, int size)
+{
+    // Keys come from their own generator so that enabling the cache does not change rand()
+    std::mt19937_64 generator(0x9E3779B97F4A7C15ULL);
+    keys = vector<vector<unsigned long long> >(cut_variables.size());
+    for (int j = 0; j < cut_variables.size(); j++) {
+        keys[j] = vector<unsigned long long>(cut_variables[j]->domain_size);
+        for (int d = 0; d < cut_variables[j]->domain_size; d++)
+            keys[j][d] = generator();
+    }
+    entries = vector<Entry>(size);
+    lookups = 0;
+    hits = 0;
+}
+
+unsigned long long CutCache::hash(const vector<Variable*>& cut_variables) const
+{
+    unsigned long long key = 0;
+    for (int j = 0; j < cut_variables.size(); j++)
+        key ^= keys[j][cut_variables[j]->value];
+    return key;
+}
+
+CutCache::Entry* CutCache::find(unsigned long long key)
+{
+    lookups++;
+    Entry& entry = entries[key % entries.size()];
+    if (entry.valid && entry.key == key) {
+        hits++;
+        return &entry;
+    }
+    return nullptr;
+}
+
+void CutCache::store(unsigned long long key, const CutEvaluation& evaluation, const vector<long long>& solution)
+{
+    // Direct-mapped: a new assignment simply replaces whatever occupied its slot
+    Entry& entry = entries[key % entries.size()];
+    entry.key = key;
+    entry.valid = true;
+    entry.evaluation = evaluation;
+    entry.solution = solution;
+}
+
+// Ranks moves for tabu search: feasible moves by value, infeasible moves by weight
+static bool is_better_move(long double value, long double weight, long double other_value, long double other_weight, long double logq)
+{
+    if (weight <= logq)
+        return other_weight > logq || value > other_value;
+    return other_weight > logq && weight < other_weight;
+}
+
+void MN::decompose(int k, Decomposition& d)
+{
+    PROFILE_SCOPE("decompose");
+    d.components = findKseparator(k, d.cut_variables);
+    d.buckets = generate_buckets(d.components);
+    int num_components = d.buckets.size()-1;
+    d.component_variables = vector<vector<Variable*> >(num_components);
+    for (int i = 0; i < num_components; i++){
+        for (std::set<int>::iterator it=d.components[i].begin(); it!=d.components[i].end(); ++it)
+            d.component_variables[i].push_back(this->variables[*it]);
+    }
+    vector<int> cut_index(variables.size(), -1);
+    d.is_cut = vector<bool>(variables.size(), false);
+    for (int j = 0; j < d.cut_variables.size(); j++) {
+        cut_index[d.cut_variables[j]->id] = j;
+        d.is_cut[d.cut_variables[j]->id] = true;
+    }
+    // The tables of component i are conditioned on the cut variables in the scope of its bucket
+    d.component_cuts = vector<vector<int> >(num_components);
+    d.cut_components = vector<vector<int> >(d.cut_variables.size());
+    for (int i = 0; i < num_components; i++){
+        set<int> cuts;
+        for (std::set<int>::iterator it=d.buckets[i].begin(); it!=d.buckets[i].end(); ++it){
+            for (auto variable : potentials[*it]->variables)
+                if (cut_index[variable->id] != -1)
+                    cuts.insert(cut_index[variable->id]);
+        }
+        d.component_cuts[i] = vector<int>(cuts.begin(), cuts.end());
+        for (int j : d.component_cuts[i])
+            d.cut_components[j].push_back(i);
+    }
+    // Two cut variables interact if they are adjacent in the primal graph or condition a common component
+    vector <set<int>> graph = primal_graph();
+    d.cut_neighbours = vector<set<int> >(d.cut_variables.size());
+    for (int j = 0; j < d.cut_variables.size(); j++){
+        for (int v : graph[d.cut_variables[j]->id])
+            if (cut_index[v] != -1)
+                d.cut_neighbours[j].insert(cut_index[v]);
+    }
+    for (int i = 0; i < num_components; i++){
+        for (int a : d.component_cuts[i])
+            for (int b : d.component_cuts[i])
+                if (a != b)
+                    d.cut_neighbours[a].insert(b);
+    }
+    d.cut_potentials = vector<vector<int> >(d.cut_variables.size());
+    for (auto p : d.buckets[num_components])
+        for (auto variable : potentials[p]->variables)
+            d.cut_potentials[cut_index[variable->id]].push_back(p);
+    d.weight_tables = vector<Potential>(num_components);
+    d.value_tables = vector<Potential>(num_components);
+    d.beam_assignments = vector<vector<vector<int> > >(num_components);
+    d.built = vector<bool>(num_components, false);
+    d.built_cut_values = vector<vector<int> >(num_components);
+    d.min_weights = vector<long double>(num_components);
+    d.max_values = vector<long double>(num_components);
+    d.bound_weights = vector<long double>(num_components);
+    d.bound_values = vector<long double>(num_components);
+    d.bound_cut_values = vector<vector<int> >(num_components);
+    d.eval_seconds = 0.0;
+    d.screen_checks = 0;
+    d.screened_infeasible = 0;
+    d.screened_dominated = 0;
+    d.mckp_calls = 0;
+}
+
+void MN::build_component_tables(MN& mn_c, Decomposition& d, int i)
+{
+    PROFILE_SCOPE("build_component_tables");
+    vector<Potential*> functions;
+    vector<Potential*> functions_c;
+    for (std::set<int>::iterator it=d.buckets[i].begin(); it!=d.buckets[i].end(); ++it){
+        functions.push_back(this->potentials[*it]);
+        functions_c.push_back(mn_c.potentials[*it]);
+    }
+    d.weight_tables[i] = Potential(functions, d.component_variables[i]);
+    d.value_tables[i] = Potential(functions_c, d.component_variables[i]);
+    PROFILE_COUNT(PROFILE_TABLE_ENTRIES, 2 * d.weight_tables[i].table.size());
+    d.built[i] = true;
+    d.built_cut_values[i] = vector<int>(d.component_cuts[i].size());
+    for (int c = 0; c < d.component_cuts[i].size(); c++)
+        d.built_cut_values[i][c] = d.cut_variables[d.component_cuts[i][c]]->value;
+    d.min_weights[i] = d.weight_tables[i].table.min();
+    d.max_values[i] = d.value_tables[i].table.max();
+}
+
+/*
+ * Partial assignment of the first variables of a component in the Pareto beam search,
+ * with the weight and value of the potentials it fully assigns
+ */
+struct BeamState {
+    long double weight;
+    long double value;
+    vector<int> values;
+};
+
+static bool BeamState_sorter(BeamState const &lhs, BeamState const &rhs)
+{
+    if (lhs.weight != rhs.weight)
+        return lhs.weight < rhs.weight;
+    return lhs.value > rhs.value;
+}
+
+// Keeps the non-dominated states among those that agree on the boundary variables, then at
+// most beam_size of them: the lightest one and the most valuable one in each slice of the weight range
+static void prune_beam(vector<BeamState>& states, const vector<int>& boundary, int beam_size)
+{
+    std::sort(states.begin(), states.end(), [&boundary](BeamState const &lhs, BeamState const &rhs) {
+        for (int u : boundary)
+            if (lhs.values[u] != rhs.values[u])
+                return lhs.values[u] < rhs.values[u];
+        return BeamState_sorter(lhs, rhs);
+    });
+    vector<BeamState> kept;
+    long double max_value = 0.0;
+    for (int s = 0; s < states.size(); s++) {
+        bool same_group = s > 0;
+        for (int b = 0; same_group && b < boundary.size(); b++)
+            same_group = states[s].values[boundary[b]] == states[s - 1].values[boundary[b]];
+        if (same_group && states[s].value <= max_value)
+            continue;
+        max_value = same_group ? std::max(max_value, states[s].value) : states[s].value;
+        kept.push_back(states[s]);
+    }
+    if (kept.size() > beam_size) {
+        int lightest = 0;
+        long double max_weight = kept[0].weight;
+        for (int s = 1; s < kept.size(); s++) {
+            if (kept[s].weight < kept[lightest].weight)
+                lightest = s;
+            max_weight = std::max(max_weight, kept[s].weight);
+        }
+        long double min_weight = kept[lightest].weight;
+        int num_slices = beam_size - 1;
+        vector<int> best(num_slices, -1);
+        for (int s = 0; s < kept.size() && num_slices > 0; s++) {
+            if (s == lightest) continue;
+            int slice = max_weight > min_weight ? (int) ((kept[s].weight - min_weight) / (max_weight - min_weight) * num_slices) : 0;
+            slice = std::min(slice, num_slices - 1);
+            if (best[slice] == -1 || kept[s].value > kept[best[slice]].value)
+                best[slice] = s;
+        }
+        vector<BeamState> thinned(1, kept[lightest]);
+        for (int slice = 0; slice < num_slices; slice++)
+            if (best[slice] != -1)
+                thinned.push_back(kept[best[slice]]);
+        kept.swap(thinned);
+    }
+    states.swap(kept);
+}
+
+void MN::build_component_beam(MN& mn_c, Decomposition& d, int i)
+{
+    PROFILE_SCOPE("build_component_beam");
+    // Bin of at most beam_size items built by a dynamic program over the component variables
+    // instead of the full joint table, whose size is exponential in the size of the component
+    vector<Variable*>& component = d.component_variables[i];
+    int h = component.size();
+    vector<int> position(variables.size(), -1);
+    for (int t = 0; t < h; t++)
+        position[component[t]->id] = t;
+    // A potential is added once its last component variable is assigned; a variable stays on
+    // the boundary until every potential containing it is added
+    vector<vector<Potential*> > weight_due(h);
+    vector<vector<Potential*> > value_due(h);
+    vector<int> last_use(h, -1);
+    for (std::set<int>::iterator it=d.buckets[i].begin(); it!=d.buckets[i].end(); ++it){
+        for (int n = 0; n < 2; n++) {
+            Potential* potential = n == 0 ? this->potentials[*it] : mn_c.potentials[*it];
+            int last = 0;
+            for (auto variable : potential->variables)
+                if (position[variable->id] != -1)
+                    last = std::max(last, position[variable->id]);
+            (n == 0 ? weight_due : value_due)[last].push_back(potential);
+            for (auto variable : potential->variables)
+                if (position[variable->id] != -1)
+                    last_use[position[variable->id]] = std::max(last_use[position[variable->id]], last);
+        }
+    }
+    vector<BeamState> states(1);
+    states[0].weight = 0.0;
+    states[0].value = 0.0;
+    for (int t = 0; t < h; t++) {
+        vector<BeamState> next;
+        next.reserve(states.size() * component[t]->domain_size);
+        for (auto& state : states) {
+            for (int u = 0; u < t; u++)
+                component[u]->value = state.values[u];
+            for (int x = 0; x < component[t]->domain_size; x++) {
+                component[t]->value = x;
+                BeamState extended = state;
+                extended.values.push_back(x);
+                for (auto potential : weight_due[t])
+                    extended.weight += potential->getValue();
+                for (auto potential : value_due[t])
+                    extended.value += potential->getValue();
+                next.push_back(extended);
+            }
+        }
+        vector<int> boundary;
+        for (int u = 0; u <= t; u++)
+            if (last_use[u] > t)
+                boundary.push_back(u);
+        prune_beam(next, boundary, GlobalSearchOptions::beam_size);
+        states.swap(next);
+    }
+    d.weight_tables[i] = Potential();
+    d.value_tables[i] = Potential();
+    d.beam_assignments[i] = vector<vector<int> >(states.size());
+    vector<long double> weights(states.size()), values(states.size());
+    for (int s = 0; s < states.size(); s++) {
+        weights[s] = states[s].weight;
+        values[s] = states[s].value;
+        d.beam_assignments[i][s] = states[s].values;
+    }
+    d.weight_tables[i].table = std::move(weights);
+    d.value_tables[i].table = std::move(values);
+    PROFILE_COUNT(PROFILE_TABLE_ENTRIES, 2 * d.weight_tables[i].table.size());
+    d.built[i] = true;
+    d.built_cut_values[i] = vector<int>(d.component_cuts[i].size());
+    for (int c = 0; c < d.component_cuts[i].size(); c++)
+        d.built_cut_values[i][c] = d.cut_variables[d.component_cuts[i][c]]->value;
+    d.min_weights[i] = d.weight_tables[i].table.min();
+    d.max_values[i] = d.value_tables[i].table.max();
+}
+
+// Reads off a solution for every q of the sweep from the bins of the current cut assignment
+// and keeps those that improve the incumbents. Leaves the component variables changed.
+static void update_sweep(MN& mn, Decomposition& d, vector<vector<long double> >& weights, vector<vector<long double> >& values,
+                         long double q_sep, long double obj_c)
+{
+    SweepIncumbents& sweep = *d.sweep;
+    MCKP hulls(weights.size());
+    for (int i = 0; i < weights.size(); i++) {
+        hulls[i] = Bin(weights[i].size());
+        for (long long j = 0; j < weights[i].size(); j++) {
+            hulls[i][j].cost = weights[i][j];
+            hulls[i][j].profit = values[i][j];
+            hulls[i][j].pos_in_bin = j;
         }
+        RemoveDominatedItems(hulls[i]);
+        ConvexHull(hulls[i]);
+    }
+    vector<long double> max_costs(sweep.logqs.size());
+    for (int j = 0; j < sweep.logqs.size(); j++)
+        max_costs[j] = sweep.logqs[j] - q_sep;
+    vector<long double> profits;
+    vector<vector<long long> > solutions;
+    parametric_MCKP(hulls, max_costs, profits, solutions);
+    for (int j = 0; j < sweep.logqs.size(); j++) {
+        if (profits[j] == -1 * std::numeric_limits<long double>::max() || profits[j] + obj_c <= sweep.values[j])
+            continue;
+        sweep.values[j] = profits[j] + obj_c;
+        for (int i = 0; i < d.component_variables.size(); i++) {
+            if (GlobalSearchOptions::beam_size > 0) {
+                for (int t = 0; t < d.component_variables[i].size(); t++)
+                    d.component_variables[i][t]->value = d.beam_assignments[i][solutions[j][i]][t];
+            } else {
+                Variable::setAddress(d.component_variables[i], solutions[j][i]);
+            }
+        }
+        mn.get_assignment(sweep.assignments[j]);
+        if (j != sweep.current)
+            sweep.updates++;
+    }
+}
+
+CutEvaluation MN::solve_components(MN& mn_c, long double logq, Decomposition& d, vector<int>& assignment, vector<long long>& solution)
+{
+    PROFILE_SCOPE("solve_components");
+    // Rebuild only the component tables whose conditioning cut variables changed since they were built
+    for (int i = 0; i < d.component_variables.size(); i++){
+        bool stale = !d.built[i];
+        for (int c = 0; !stale && c < d.component_cuts[i].size(); c++)
+            stale = d.cut_variables[d.component_cuts[i][c]]->value != d.built_cut_values[i][c];
+        if (stale && GlobalSearchOptions::beam_size > 0)
+            build_component_beam(mn_c, d, i);
+        else if (stale)
+            build_component_tables(mn_c, d, i);
+    }
+    //conditioning logq on k-sep vars of original MN
+    vector<set<int>>& buckets = d.buckets;
+    long double q_sep = 0.0;
+    for (std::set<int>::iterator it=buckets[buckets.size()-1].begin(); it!=buckets[buckets.size()-1].end(); ++it)
+        q_sep += this->potentials[*it]->getValue();
+    long double obj_c = 0.0;
+    for (std::set<int>::iterator it=buckets[buckets.size()-1].begin(); it!=buckets[buckets.size()-1].end(); ++it)
+        obj_c += mn_c.potentials[*it]->getValue();
+
+    long double new_logq = logq - q_sep;
+    // The solution is the entry selected in every joint table, or the values of the component
+    // variables of the items selected in bounded bins, which are only valid for these cut values
+    vector<vector<long double> > weights(d.weight_tables.size());
+    vector<vector<long double> > values(d.value_tables.size());
+    for (int i = 0; i < d.weight_tables.size(); i++) {
+        weights[i] = d.weight_tables[i].table.values();
+        values[i] = d.value_tables[i].table.values();
+    }
+    d.mckp_calls++;
+    long double greedy_output = greedy_solve_MCKP(weights, values, new_logq, solution, d.generator);
+    if (d.sweep != nullptr)
+        update_sweep(*this, d, weights, values, q_sep, obj_c);
+    if (GlobalSearchOptions::beam_size > 0) {
+        vector<long long> items;
+        items.swap(solution);
+        for (int i = 0; i < items.size(); i++)
+            solution.insert(solution.end(), d.beam_assignments[i][items[i]].begin(), d.beam_assignments[i][items[i]].end());
+    }
+    restore_components(d, solution, assignment);
+    CutEvaluation evaluation;
+    evaluation.value = greedy_output + obj_c;
+    evaluation.min_weight = q_sep;
+    for (int i = 0; i < d.min_weights.size(); i++)
+        evaluation.min_weight += d.min_weights[i];
+    evaluation.feasible = greedy_output > -1 * std::numeric_limits<long double>::max();
+    return evaluation;
+}
+
+void MN::restore_components(Decomposition& d, const vector<long long>& solution, vector<int>& assignment)
+{
+    int next = 0;
+    for (int i = 0; i < d.component_variables.size(); i++) {
+        if (GlobalSearchOptions::beam_size > 0) {
+            for (auto variable : d.component_variables[i])
+                variable->value = solution[next++];
+        } else {
+            Variable::setAddress(d.component_variables[i], solution[i]);
+        }
+        for (auto variable : d.component_variables[i])
+            assignment[variable->id] = variable->value;
+    }
+}
+
+// Whether entry a of a potential agrees with the values of the cut variables in its scope
+static bool consistent_with_cut(Potential* potential, const vector<bool>& is_cut, long long a)
+{
+    for (auto variable : potential->variables) {
+        if (is_cut[variable->id] && a % variable->domain_size != variable->value)
+            return false;
+        a /= variable->domain_size;
+    }
+    return true;
+}
+
+// Smallest (or largest) entry of a potential among those consistent with the values of the cut variables
+static long double conditioned_extreme(Potential* potential, const vector<bool>& is_cut, bool maximize)
+{
+    bool conditioned = false;
+    for (auto variable : potential->variables)
+        conditioned = conditioned || is_cut[variable->id];
+    // Computed once per (shared) table
+    if (!conditioned)
+        return maximize ? potential->table.max() : potential->table.min();
+    long double extreme = maximize ? -1 * std::numeric_limits<long double>::max() : std::numeric_limits<long double>::max();
+    if (potential->table.compressed()) {
+        // One value per run: a run is only searched for a consistent entry if it improves the extreme
+        const TableData& data = *potential->table.data;
+        for (int r = 0; r < data.run_starts.size(); r++) {
+            long double value = data.run_values[r];
+            if (maximize ? value <= extreme : value >= extreme)
+                continue;
+            long long last = r + 1 < data.run_starts.size() ? data.run_starts[r + 1] : data.size;
+            for (long long a = data.run_starts[r]; a < last; a++) {
+                if (consistent_with_cut(potential, is_cut, a)) {
+                    extreme = value;
+                    break;
+                }
+            }
+        }
+        return extreme;
+    }
+    for (long long a = 0; a < potential->table.size(); a++)
+        if (consistent_with_cut(potential, is_cut, a))
+            extreme = maximize ? std::max(extreme, potential->table[a]) : std::min(extreme, potential->table[a]);
+    return extreme;
+}
+
+bool MN::screen_cut_assignment(MN& mn_c, long double logq, Decomposition& d, long double threshold, CutEvaluation& evaluation)
+{
+    PROFILE_SCOPE("screen_cut_assignment");
+    d.screen_checks++;
+    vector<set<int>>& buckets = d.buckets;
+    long double min_weight = 0.0;
+    long double max_value = 0.0;
+    for (std::set<int>::iterator it=buckets[buckets.size()-1].begin(); it!=buckets[buckets.size()-1].end(); ++it) {
+        min_weight += this->potentials[*it]->getValue();
+        max_value += mn_c.potentials[*it]->getValue();
+    }
+    for (int i = 0; i < d.component_variables.size(); i++) {
+        vector<int> cut_values(d.component_cuts[i].size());
+        for (int c = 0; c < d.component_cuts[i].size(); c++)
+            cut_values[c] = d.cut_variables[d.component_cuts[i][c]]->value;
+        // The summaries of a table built for these cut values are exact
+        if (d.built[i] && d.built_cut_values[i] == cut_values) {
+            min_weight += d.min_weights[i];
+            max_value += d.max_values[i];
+            continue;
+        }
+        if (d.bound_cut_values[i].empty() || d.bound_cut_values[i] != cut_values) {
+            d.bound_weights[i] = 0.0;
+            d.bound_values[i] = 0.0;
+            for (std::set<int>::iterator it=buckets[i].begin(); it!=buckets[i].end(); ++it) {
+                d.bound_weights[i] += conditioned_extreme(this->potentials[*it], d.is_cut, false);
+                d.bound_values[i] += conditioned_extreme(mn_c.potentials[*it], d.is_cut, true);
+            }
+            d.bound_cut_values[i] = cut_values;
+        }
+        min_weight += d.bound_weights[i];
+        max_value += d.bound_values[i];
+    }
+    if (min_weight > logq) {
+        d.screened_infeasible++;
+    } else if (max_value <= threshold) {
+        d.screened_dominated++;
+    } else {
+        return false;
+    }
+    evaluation.value = -1 * std::numeric_limits<long double>::max();
+    evaluation.min_weight = min_weight;
+    evaluation.feasible = false;
+    evaluation.screened = true;
+    return true;
+}
+
+CutEvaluation MN::evaluate_cut_assignment(MN& mn_c, long double logq, Decomposition& d, CutCache* cache, unsigned long long key,
+                                          vector<int>& assignment, long double threshold)
+{
+    CutCache::Entry* entry = cache != nullptr ? cache->find(key) : nullptr;
+    if (entry != nullptr) {
+        restore_components(d, entry->solution, assignment);
+        return entry->evaluation;
+    }
+    // Screened assignments keep their current component values and are not cached
+    CutEvaluation screened;
+    if (GlobalSearchOptions::screen && screen_cut_assignment(mn_c, logq, d, threshold, screened))
+        return screened;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    vector<long long> solution;
+    CutEvaluation evaluation = solve_components(mn_c, logq, d, assignment, solution);
+    if (cache != nullptr)
+        cache->store(key, evaluation, solution);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    // Running average of the cost of an evaluation, used to size LNS neighbourhoods
+    d.eval_seconds = d.eval_seconds == 0.0 ? seconds : 0.9 * d.eval_seconds + 0.1 * seconds;
+    return evaluation;
+}
+
+// Fraction of the remaining time that a single LNS step may spend enumerating its neighbourhood
+static const double LNS_TIME_FRACTION = 0.05;
+
+bool MN::lns_move(MN& mn_c, long double logq, Decomposition& d, CutCache* cache, unsigned long long& key, vector<int>& assignment,
+                  const CutEvaluation& current, long double& best_prob, vector<int>& best_assignment, double remaining_seconds,
+                  int& group_size)
+{
+    PROFILE_SCOPE("lns_move");
+    vector<Variable*>& cut_variables = d.cut_variables;
+    // Grow a group of interacting cut variables breadth first from a random seed while its
+    // joint assignments can be enumerated within the time allotted to this step
+    double budget = remaining_seconds * LNS_TIME_FRACTION;
+    vector<int> group;
+    vector<bool> queued(cut_variables.size(), false);
+    vector<int> queue(1, rand() % cut_variables.size());
+    queued[queue[0]] = true;
+    long long num_combinations = 1;
+    for (int q = 0; q < queue.size() && group.size() < GlobalSearchOptions::lns_size; q++) {
+        int j = queue[q];
+        long long extended = num_combinations * cut_variables[j]->domain_size;
+        if (!group.empty() && extended * d.eval_seconds > budget)
+            break;
+        group.push_back(j);
+        num_combinations = extended;
+        for (int n : d.cut_neighbours[j]) {
+            if (!queued[n]) {
+                queued[n] = true;
+                queue.push_back(n);
+            }
+        }
+    }
+    group_size = group.size();
+    // Enumerate the joint assignments of the group with the component MCKP as the inner objective
+    vector<int> original(group.size());
+    for (int g = 0; g < group.size(); g++)
+        original[g] = cut_variables[group[g]]->value;
+    vector<int> values(group.size(), 0);
+    vector<int> best_values = original;
+    CutEvaluation best = current;
+    for (long long c = 0; c < num_combinations; c++) {
+        for (int g = 0; g < group.size(); g++) {
+            Variable* variable = cut_variables[group[g]];
+            if (cache != nullptr)
+                key = cache->move(key, group[g], variable->value, values[g]);
+            variable->value = values[g];
+            assignment[variable->id] = values[g];
+        }
+        CutEvaluation evaluation = evaluate_cut_assignment(mn_c, logq, d, cache, key, assignment, best_prob);
+        // Infeasible assignments are ranked by how close they come to feasibility
+        if (is_better_move(evaluation.value, evaluation.feasible ? logq : evaluation.min_weight, best.value,
+                           best.feasible ? logq : best.min_weight, logq)) {
+            best = evaluation;
+            best_values = values;
+        }
+        // The components hold the solution of this combination until the next one is evaluated
+        if (evaluation.feasible && evaluation.value > best_prob) {
+            best_prob = evaluation.value;
+            get_assignment(best_assignment);
+        }
+        for (int g = 0; g < group.size(); g++) {
+            if (++values[g] < cut_variables[group[g]]->domain_size) break;
+            values[g] = 0;
+        }
+    }
+    for (int g = 0; g < group.size(); g++) {
+        Variable* variable = cut_variables[group[g]];
+        if (cache != nullptr)
+            key = cache->move(key, group[g], variable->value, best_values[g]);
+        variable->value = best_values[g];
+        assignment[variable->id] = best_values[g];
+    }
+    return best_values != original;
+}
+
+void MN::get_assignment(vector<int>& values)
+{
+    values = vector<int>(variables.size());
+    for (int i = 0; i < variables.size(); i++)
+        values[i] = variables[i]->value;
+}
+
+void MN::set_assignment(const vector<int>& values)
+{
+    for (int i = 0; i < variables.size(); i++)
+        variables[i]->value = values[i];
+}
+
+void MN::start_search(MN& mn_c, long double logq, int k, SearchState& s, const vector<int>& warm_start)
+{
+    // A decomposition left in the state, by the search for another q, is reused with its tables
+    Decomposition d = std::move(s.d);
+    s = SearchState();
+    s.k = k;
+    s.started = true;
+    s.d = std::move(d);
+    if (s.d.buckets.empty())
+        decompose(k, s.d);
+    cout<<"Statistics:"<<endl;
+    cout<<"K = "<<k<<endl;
+    cout<<"Number of Variables in the K-separator = "<<s.d.cut_variables.size()<<endl;
+    cout<<"Number of components = "<<s.d.buckets.size()-1<<endl;
+    for (int i = 0; i<s.d.buckets.size()-1; i++){
+        cout<<"number of variables in component "<<i+1<<" "<<s.d.components[i].size()<<endl;
+    }
+    s.mckp_calls_base = s.d.mckp_calls;
+    if (Telemetry::enabled) {
+        ostringstream fields;
+        fields << std::fixed << std::setprecision(6) << "\"event\":\"start\",\"time\":" << Telemetry::now()
+               << ",\"q\":" << Telemetry::number(logq) << ",\"k\":" << k << ",\"cut_variables\":" << s.d.cut_variables.size()
+               << ",\"components\":" << s.d.buckets.size() - 1;
+        Telemetry::write(fields.str());
+    }
+    // Start from the best assignment found for a previous k if there is one
+    if (!warm_start.empty()) {
+        set_assignment(warm_start);
+        if (getValue() <= logq) {
+            s.best_prob = mn_c.getValue();
+            s.best_assignment = warm_start;
+        }
+    } else {
         for(int i=0;i<variables.size();i++){
             variables[i]->value=rand()%variables[i]->domain_size;
         }
-        //run for sampling number
-        int num_assignments_explored=0;
+    }
+    get_assignment(s.assignment);
+    if (GlobalSearchOptions::cache_size > 0) {
+        s.cache.init(s.d.cut_variables, GlobalSearchOptions::cache_size);
+        s.cut_hash = s.cache.hash(s.d.cut_variables);
+    }
+    // tabu_until[j]: iteration up to which cut variable j may not be changed
+    s.tabu_until = vector<int>(s.d.cut_variables.size(), 0);
+    s.current.min_weight = std::numeric_limits<long double>::max();
+}
+
+// True once the best value is provably within the relative gap of the upper bound
+static bool is_gap_closed(long double best, long double upper_bound)
+{
+    if (best == -1 * std::numeric_limits<long double>::max() || upper_bound == std::numeric_limits<long double>::max())
+        return false;
+    return upper_bound - best <= GlobalSearchOptions::gap * fabsl(best);
+}
+
+// Deep copy of the pair of networks and of the decomposition of the search for k
+static SearchWorker* new_worker(MN& mn, MN& mn_c, int k)
+{
+    SearchWorker* worker = new SearchWorker();
+    for (auto variable : mn.variables) {
+        Variable* copy = new Variable(variable->id, variable->domain_size);
+        copy->value = variable->value;
+        worker->mn.variables.push_back(copy);
+    }
+    worker->mn_c.variables = worker->mn.variables;
+    for (int n = 0; n < 2; n++) {
+        for (auto potential : n == 0 ? mn.potentials : mn_c.potentials) {
+            Potential* copy = new Potential();
+            for (auto variable : potential->variables)
+                copy->variables.push_back(worker->mn.variables[variable->id]);
+            copy->table = potential->table;
+            (n == 0 ? worker->mn : worker->mn_c).potentials.push_back(copy);
+        }
+    }
+    worker->mn.decompose(k, worker->d);
+    worker->d.generator = &worker->generator;
+    return worker;
+}
+
+static void delete_worker(SearchWorker* worker)
+{
+    for (auto potential : worker->mn.potentials)
+        delete potential;
+    for (auto potential : worker->mn_c.potentials)
+        delete potential;
+    for (auto variable : worker->mn.variables)
+        delete variable;
+    delete worker;
+}
+
+/*
+ * Threads of the workers of a search, started with the workers and kept until the search
+ * finishes. run hands the same task to every thread, called with the index of its worker,
+ * and returns once all of them are done
+ */
+struct WorkerPool {
+    vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable task_ready;
+    std::condition_variable task_done;
+    std::function<void(int)> task;
+    long long generation;
+    int busy;
+    bool stopping;
+    WorkerPool(int num_threads) : generation(0), busy(0), stopping(false) {
+        for (int w = 0; w < num_threads; w++)
+            threads.push_back(std::thread(&WorkerPool::loop, this, w));
+    }
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        task_ready.notify_all();
+        for (auto& thread : threads)
+            thread.join();
+    }
+    void run(const std::function<void(int)>& task_) {
+        std::unique_lock<std::mutex> lock(mutex);
+        task = task_;
+        busy = threads.size();
+        generation++;
+        task_ready.notify_all();
+        task_done.wait(lock, [this] { return busy == 0; });
+    }
+    void loop(int w) {
+        long long done = 0;
         while (true) {
-            num_assignments_explored++;
-            //random values to k sep variables for both MNs
-            long double current_value=mn_c.getValue();
-            long double current_weight=this->getValue();
-            int change_variable=-1;
-            int change_value=-1;
-            // If the current solution is not feasible move towards a feasible solution
-            if (current_weight > logq) {
-                for (int j = 0; j < cut_variables.size(); j++) {
-                    int index = cut_variables[j]->value;
-                    for (int k = 0; k < cut_variables[j]->domain_size; k++) {
-                        if (index == k) continue;
-                        cut_variables[j]->value = k;
-                        long double sol_value = mn_c.getValue();
-                        long double sol_weight = getValue();
-                        // If you have already found a feasible solution move towards better objective
-                        if (current_weight <= logq) {
-                            if (sol_weight <= logq && sol_value > current_value) {
-                                current_value = sol_value;
-                                current_weight = sol_weight;
-                                change_variable = j;
-                                change_value = k;
-                            }
-                        } else {
-                            if (sol_weight < current_weight) {
-                                current_value = sol_value;
-                                current_weight = sol_weight;
-                                change_variable = j;
-                                change_value = k;
-                            }
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                task_ready.wait(lock, [&] { return stopping || generation != done; });
+                if (stopping)
+                    return;
+                done = generation;
+            }
+            task(w);
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--busy == 0)
+                task_done.notify_one();
+        }
+    }
+};
+
+/*
+ * Candidate of a batch: a full assignment whose cut values are evaluated, and the result.
+ * solution is left empty if the evaluation was taken from the cache or screened. seed is drawn
+ * on the search thread for the MCKP solver of the worker evaluating the candidate.
+ */
+struct BatchCandidate {
+    vector<int> assignment;
+    unsigned long long key;
+    bool done;
+    unsigned int seed;
+    CutEvaluation evaluation;
+    vector<long long> solution;
+    BatchCandidate() : key(0), done(false), seed(0) {}
+};
+
+// Evaluates every stride-th candidate from first on the networks of one worker
+static void evaluate_candidates(SearchWorker* worker, long double logq, long double threshold, vector<BatchCandidate>* candidates,
+                                int first, int stride)
+{
+    for (int c = first; c < candidates->size(); c += stride) {
+        BatchCandidate& candidate = (*candidates)[c];
+        if (candidate.done) continue;
+        worker->mn.set_assignment(candidate.assignment);
+        if (GlobalSearchOptions::screen &&
+            worker->mn.screen_cut_assignment(worker->mn_c, logq, worker->d, threshold, candidate.evaluation))
+            continue;
+        worker->generator.seed(candidate.seed);
+        candidate.evaluation = worker->mn.solve_components(worker->mn_c, logq, worker->d, candidate.assignment, candidate.solution);
+    }
+}
+
+CutEvaluation MN::evaluate_batch(MN& mn_c, long double logq, SearchState& s, const vector<int>& previous,
+                                 const vector<pair<int, int> >& moves)
+{
+    PROFILE_SCOPE("evaluate_batch");
+    Decomposition& d = s.d;
+    vector<Variable*>& cut_variables = d.cut_variables;
+    bool use_cache = GlobalSearchOptions::cache_size > 0;
+    int batch_size = GlobalSearchOptions::batch_size;
+    if (s.workers.empty()) {
+        int num_workers = std::min(batch_size, (int) std::max(1u, std::thread::hardware_concurrency()));
+        for (int w = 0; w < num_workers; w++)
+            s.workers.push_back(new_worker(*this, mn_c, s.k));
+        s.pool = new WorkerPool(num_workers);
+    }
+    // The accepted move, then the next best moves of the scan and random moves from the accepted one
+    vector<BatchCandidate> candidates(1);
+    get_assignment(candidates[0].assignment);
+    for (int m = 0; m < moves.size() && candidates.size() < batch_size; m++) {
+        BatchCandidate candidate;
+        candidate.assignment = previous;
+        candidate.assignment[cut_variables[moves[m].first]->id] = moves[m].second;
+        if (candidate.assignment != candidates[0].assignment)
+            candidates.push_back(candidate);
+    }
+    for (int attempt = 0; attempt < batch_size && candidates.size() < batch_size; attempt++) {
+        BatchCandidate candidate;
+        candidate.assignment = candidates[0].assignment;
+        int j = rand() % cut_variables.size();
+        candidate.assignment[cut_variables[j]->id] = rand() % cut_variables[j]->domain_size;
+        if (candidate.assignment != candidates[0].assignment)
+            candidates.push_back(candidate);
+    }
+    // Revisited candidates are answered by the cache on this thread
+    for (auto& candidate : candidates) {
+        if (!use_cache) continue;
+        candidate.key = s.cut_hash;
+        for (int j = 0; j < cut_variables.size(); j++) {
+            int from = candidates[0].assignment[cut_variables[j]->id];
+            int to = candidate.assignment[cut_variables[j]->id];
+            if (from != to)
+                candidate.key = s.cache.move(candidate.key, j, from, to);
+        }
+        CutCache::Entry* entry = s.cache.find(candidate.key);
+        if (entry != nullptr) {
+            restore_components(d, entry->solution, candidate.assignment);
+            candidate.evaluation = entry->evaluation;
+            candidate.done = true;
+        }
+    }
+    for (auto& candidate : candidates)
+        candidate.seed = rand();
+    long double threshold = s.best_prob;
+    s.pool->run([&](int w) {
+        evaluate_candidates(s.workers[w], logq, threshold, &candidates, w, (int) s.workers.size());
+    });
+    // Commit to the best candidate; the accepted move wins ties
+    int chosen = 0;
+    for (int c = 0; c < candidates.size(); c++) {
+        CutEvaluation& evaluation = candidates[c].evaluation;
+        if (use_cache && !candidates[c].solution.empty())
+            s.cache.store(candidates[c].key, evaluation, candidates[c].solution);
+        CutEvaluation& best = candidates[chosen].evaluation;
+        if (is_better_move(evaluation.value, evaluation.feasible ? logq : evaluation.min_weight, best.value,
+                           best.feasible ? logq : best.min_weight, logq))
+            chosen = c;
+    }
+    set_assignment(candidates[chosen].assignment);
+    s.assignment = candidates[chosen].assignment;
+    if (use_cache)
+        s.cut_hash = candidates[chosen].key;
+    s.batch_steps++;
+    if (chosen != 0) {
+        s.batch_alternatives_taken++;
+        for (int j = 0; j < cut_variables.size() && GlobalSearchOptions::tabu_tenure > 0; j++)
+            if (previous[cut_variables[j]->id] != cut_variables[j]->value)
+                s.tabu_until[j] = s.num_assignments_explored + GlobalSearchOptions::tabu_tenure;
+    }
+    return candidates[chosen].evaluation;
+}
+
+// Weight of a full assignment, without changing the values of the variables
+static long double assignment_weight(MN& mn, const vector<int>& assignment)
+{
+    long double weight = 0.0;
+    for (auto potential : mn.potentials) {
+        long long address = 0;
+        long long multiplier = 1;
+        for (auto variable : potential->variables) {
+            address += multiplier * assignment[variable->id];
+            multiplier *= variable->domain_size;
+        }
+        weight += potential->table[address];
+    }
+    return weight;
+}
+
+// Telemetry of a search: an incumbent record with the best assignment, numbered as in the UAI
+// file, whenever the best value improved, and a status record when Telemetry::interval seconds
+// of this search passed since the last one (or if force). Rates are over that interval
+static void write_telemetry(MN& mn, MN& mn_c, long double logq, SearchState& s, double search_seconds, bool force)
+{
+    if (s.best_prob > s.telemetry_best && !s.best_assignment.empty()) {
+        s.telemetry_best = s.best_prob;
+        s.best_weight = assignment_weight(mn, s.best_assignment);
+        vector<int> uai_assignment;
+        mn.expand_assignment(s.best_assignment, uai_assignment);
+        ostringstream fields;
+        fields << std::fixed << std::setprecision(6) << "\"event\":\"incumbent\",\"time\":" << Telemetry::now()
+               << ",\"q\":" << Telemetry::number(logq) << ",\"k\":" << s.k << ",\"iterations\":" << s.num_assignments_explored
+               << ",\"value\":" << Telemetry::number(s.best_prob) << ",\"weight\":" << Telemetry::number(s.best_weight);
+        Telemetry::write(fields.str(), std::move(uai_assignment));
+    }
+    double seconds = search_seconds - s.telemetry_time;
+    if (!force && seconds < Telemetry::interval)
+        return;
+    long long mckp_calls = s.d.mckp_calls - s.mckp_calls_base;
+    for (auto worker : s.workers)
+        mckp_calls += worker->d.mckp_calls;
+    ostringstream fields;
+    fields << std::fixed << std::setprecision(6) << "\"event\":\"status\",\"time\":" << Telemetry::now()
+           << ",\"q\":" << Telemetry::number(logq) << ",\"k\":" << s.k << ",\"search_time\":" << search_seconds
+           << ",\"iterations\":" << s.num_assignments_explored
+           << ",\"iterations_per_s\":" << (seconds > 0 ? (s.num_assignments_explored - s.telemetry_iterations) / seconds : 0.0)
+           << ",\"mckp_calls\":" << mckp_calls
+           << ",\"mckp_calls_per_s\":" << (seconds > 0 ? (mckp_calls - s.telemetry_mckp_calls) / seconds : 0.0)
+           << ",\"current_value\":" << Telemetry::number(mn_c.getValue()) << ",\"current_weight\":" << Telemetry::number(mn.getValue())
+           << ",\"best_value\":" << Telemetry::number(s.best_prob) << ",\"best_weight\":" << Telemetry::number(s.best_weight)
+           << ",\"feasible_ratio\":" << (s.evaluations > 0 ? (double) s.feasible_evaluations / s.evaluations : 0.0);
+    Telemetry::write(fields.str());
+    s.telemetry_time = search_seconds;
+    s.telemetry_iterations = s.num_assignments_explored;
+    s.telemetry_mckp_calls = mckp_calls;
+}
+
+// True if the value of cut variable j hits a zero entry of a potential over cut variables only,
+// which no assignment of the components can repair
+static bool hard_move(MN& mn_c, Decomposition& d, int j)
+{
+    for (auto p : d.cut_potentials[j])
+        if (mn_c.potentials[p]->getValue() == -std::numeric_limits<long double>::infinity())
+            return true;
+    return false;
+}
+
+// A move of the neighbourhood scan, kept to fill a batch of candidates
+struct ScannedMove {
+    long double value;
+    long double weight;
+    int variable;
+    int value_index;
+};
+
+void MN::search(MN& mn_c, long double logq, SearchState& s, double seconds, ostream& out1)
+{
+    PROFILE_SCOPE("search");
+    bool tabu_search = GlobalSearchOptions::tabu_tenure > 0;
+    bool use_cache = GlobalSearchOptions::cache_size > 0;
+    Decomposition& d = s.d;
+    vector<Variable*>& cut_variables = d.cut_variables;
+    CutCache& cache = s.cache;
+    unsigned long long& cut_hash = s.cut_hash;
+    vector<int>& tabu_until = s.tabu_until;
+    vector<int>& assignment = s.assignment;
+    CutEvaluation& current = s.current;
+    long double& best_prob = s.best_prob;
+    int& num_assignments_explored = s.num_assignments_explored;
+    // Resume from the assignment at which this search was paused
+    set_assignment(assignment);
+    std::chrono::steady_clock::time_point slice_start = std::chrono::steady_clock::now();
+    double elapsed = 0.0;
+    while (true) {
+        num_assignments_explored++;
+        PROFILE_COUNT(PROFILE_ITERATIONS, 1);
+        bool batch = GlobalSearchOptions::batch_size > 1 && !cut_variables.empty();
+        vector<int> previous;
+        vector<ScannedMove> scanned;
+        if (batch)
+            get_assignment(previous);
+        //random values to k sep variables for both MNs
+        long double current_value=mn_c.getValue();
+        long double current_weight=this->getValue();
+        int change_variable=-1;
+        int change_value=-1;
+        // Best admissible move, taken by tabu search when no move improves the current solution
+        int tabu_variable=-1;
+        int tabu_value=-1;
+        long double tabu_move_value=-1 * std::numeric_limits<long double>::max();
+        long double tabu_move_weight=std::numeric_limits<long double>::max();
+        // If the current solution is not feasible move towards a feasible solution
+        if (current_weight > logq) {
+            PROFILE_SCOPE("neighbourhood scan");
+            for (int j = 0; j < cut_variables.size(); j++) {
+                int index = cut_variables[j]->value;
+                for (int k = 0; k < cut_variables[j]->domain_size; k++) {
+                    if (index == k) continue;
+                    cut_variables[j]->value = k;
+                    if (hard_move(mn_c, d, j)) continue;
+                    long double sol_value = mn_c.getValue();
+                    long double sol_weight = getValue();
+                    if (tabu_search) {
+                        // Tabu moves are skipped unless they yield a new best feasible solution (aspiration)
+                        if (tabu_until[j] > num_assignments_explored &&
+                            !(GlobalSearchOptions::tabu_aspiration && sol_weight <= logq && sol_value > best_prob))
+                            continue;
+                        if (is_better_move(sol_value, sol_weight, tabu_move_value, tabu_move_weight, logq)) {
+                            tabu_move_value = sol_value;
+                            tabu_move_weight = sol_weight;
+                            tabu_variable = j;
+                            tabu_value = k;
                         }
                     }
-                    cut_variables[j]->value = index;
-                }
-            }
-            else {
-                for (int j = 0; j < cut_variables.size(); j++) {
-                    int index = cut_variables[j]->value;
-                    for (int k = 0; k < cut_variables[j]->domain_size; k++) {
-                        if (index == k) continue;
-                        cut_variables[j]->value = k;
-                        long double sol_value = mn_c.getValue();
-                        long double sol_weight = getValue();
+                    if (batch) {
+                        ScannedMove move = {sol_value, sol_weight, j, k};
+                        scanned.push_back(move);
+                    }
+                    // If you have already found a feasible solution move towards better objective
+                    if (current_weight <= logq) {
                         if (sol_weight <= logq && sol_value > current_value) {
                             current_value = sol_value;
+                            current_weight = sol_weight;
+                            change_variable = j;
+                            change_value = k;
+                        }
+                    } else {
+                        if (sol_weight < current_weight) {
+                            current_value = sol_value;
+                            current_weight = sol_weight;
                             change_variable = j;
                             change_value = k;
-                            if (sol_value > best_prob) {
-                                best_prob = sol_value;
-                            }
                         }
                     }
-                    cut_variables[j]->value = index;
                 }
+                cut_variables[j]->value = index;
             }
-            // Check for Local maxima
-            if (change_variable==-1){
-                    //Escape the local maxima by making random assignments to cut variables
-                    // With 10% probability make a random global move
-                    if (rand()%100>=90){
-                        for (int j = 0; j < cut_variables.size(); j++) {
-                            cut_variables[j]->value = rand() % cut_variables[j]->domain_size;
-                            assignment[cut_variables[j]->id] = cut_variables[j]->value;
+        }
+        else {
+            PROFILE_SCOPE("neighbourhood scan");
+            for (int j = 0; j < cut_variables.size(); j++) {
+                int index = cut_variables[j]->value;
+                for (int k = 0; k < cut_variables[j]->domain_size; k++) {
+                    if (index == k) continue;
+                    cut_variables[j]->value = k;
+                    if (hard_move(mn_c, d, j)) continue;
+                    long double sol_value = mn_c.getValue();
+                    long double sol_weight = getValue();
+                    if (tabu_search) {
+                        if (tabu_until[j] > num_assignments_explored &&
+                            !(GlobalSearchOptions::tabu_aspiration && sol_weight <= logq && sol_value > best_prob))
+                            continue;
+                        if (is_better_move(sol_value, sol_weight, tabu_move_value, tabu_move_weight, logq)) {
+                            tabu_move_value = sol_value;
+                            tabu_move_weight = sol_weight;
+                            tabu_variable = j;
+                            tabu_value = k;
                         }
                     }
-                    else {
-                        // With 90% probability make a local random move
-                        int j=rand()%cut_variables.size();
-                        cut_variables[j]->value = rand() % cut_variables[j]->domain_size;
-                        assignment[cut_variables[j]->id] = cut_variables[j]->value;
+                    if (batch) {
+                        ScannedMove move = {sol_value, sol_weight, j, k};
+                        scanned.push_back(move);
                     }
+                    if (sol_weight <= logq && sol_value > current_value) {
+                        current_value = sol_value;
+                        change_variable = j;
+                        change_value = k;
+                        if (sol_value > best_prob) {
+                            best_prob = sol_value;
+                            get_assignment(s.best_assignment);
+                        }
+                    }
+                }
+                cut_variables[j]->value = index;
             }
-            else {
-                // No local maxima: Accept the move
-                assignment[cut_variables[change_variable]->id] = change_value;
-                cut_variables[change_variable]->value=change_value;
-            }
-
-            //generating functions for greedy for both MNs
-            vector<Potential> greedy_functions;
-            vector<Potential> greedy_functions_c;
-            for (int i = 0; i<buckets.size()-1; i++){
-                vector<Potential*> functions;
-                vector<Potential*> functions_c;
-                vector<Variable*> component_variables;
-                for (std::set<int>::iterator it=buckets[i].begin(); it!=buckets[i].end(); ++it){
-                    functions.push_back(this->potentials[*it]);
-                    functions_c.push_back(mn_c.potentials[*it]);
+        }
+        // Tabu search leaves a local maxima through the best admissible move, even if it is worse
+        if (change_variable==-1 && tabu_variable!=-1){
+            change_variable = tabu_variable;
+            change_value = tabu_value;
+        }
+        // Large neighbourhood search: re-optimize a group of interacting cut variables exactly
+        bool lns_improved = false;
+        if (change_variable==-1 && GlobalSearchOptions::lns_size > 0 && !cut_variables.empty()){
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - slice_start).count();
+            int group_size;
+            lns_improved = lns_move(mn_c, logq, d, use_cache ? &cache : nullptr, cut_hash, assignment,
+                                    current, best_prob, s.best_assignment, seconds - elapsed, group_size);
+            s.lns_steps++;
+            s.lns_group_sizes += group_size;
+            if (lns_improved)
+                s.lns_improvements++;
+        }
+        // Check for Local maxima (nothing to escape to without cut variables)
+        if (change_variable==-1 && !lns_improved && !cut_variables.empty()){
+                PROFILE_COUNT(PROFILE_MOVES, 1);
+                //Escape the local maxima by making random assignments to cut variables
+                // With 10% probability make a random global move
+                if (rand()%100>=90){
+                    for (int j = 0; j < cut_variables.size(); j++) {
+                        int value = rand() % cut_variables[j]->domain_size;
+                        if (use_cache)
+                            cut_hash = cache.move(cut_hash, j, cut_variables[j]->value, value);
+                        cut_variables[j]->value = value;
+                        assignment[cut_variables[j]->id] = cut_variables[j]->value;
+                    }
+                }
+                else {
+                    // With 90% probability make a local random move
+                    int j=rand()%cut_variables.size();
+                    int value = rand() % cut_variables[j]->domain_size;
+                    if (use_cache)
+                        cut_hash = cache.move(cut_hash, j, cut_variables[j]->value, value);
+                    cut_variables[j]->value = value;
+                    assignment[cut_variables[j]->id] = cut_variables[j]->value;
                 }
-                for (std::set<int>::iterator it=components[i].begin(); it!=components[i].end(); ++it)
-                    component_variables.push_back(this->variables[*it]);
-                greedy_functions.emplace_back(functions, component_variables);
-                greedy_functions_c.emplace_back(functions_c, component_variables);
-            }
-            //conditioning logq on k-sep vars of original MN
-            long double q_sep = 0.0;
-            for (std::set<int>::iterator it=buckets[buckets.size()-1].begin(); it!=buckets[buckets.size()-1].end(); ++it)
-                q_sep += this->potentials[*it]->getValue();
-            long double obj_c = 0.0;
-            for (std::set<int>::iterator it=buckets[buckets.size()-1].begin(); it!=buckets[buckets.size()-1].end(); ++it)
-                obj_c += mn_c.potentials[*it]->getValue();
-
-            long double new_logq = logq - q_sep;
-            knapsack_greedy(new_logq, greedy_functions, greedy_functions_c, assignment, greedy_output);
-            if ((greedy_output + obj_c) > best_prob){
-                best_prob = greedy_output + obj_c;
-            }
-            std::time_t curr_time = std::time(nullptr);
-            if ((curr_time - start_time) % GlobalSearchOptions::print_interval == 0 && write_time != curr_time) {
-                write_time = std::time(nullptr);
-
-                out1 << logq << "," << h << "," <<  best_prob << ',' << curr_time - start_time << "\n";
-                cerr << std::setprecision(20) <<logq << "," << h << "," <<  best_prob << ',' << num_assignments_explored<<","<<curr_time - start_time << "\n";
-            }
-            if ((curr_time - start_time) >= max_time) {
+        }
+        else if (change_variable!=-1) {
+            // No local maxima: Accept the move
+            PROFILE_COUNT(PROFILE_MOVES, 1);
+            if (use_cache)
+                cut_hash = cache.move(cut_hash, change_variable, cut_variables[change_variable]->value, change_value);
+            assignment[cut_variables[change_variable]->id] = change_value;
+            cut_variables[change_variable]->value=change_value;
+            if (tabu_search)
+                tabu_until[change_variable] = num_assignments_explored + GlobalSearchOptions::tabu_tenure;
+        }
+
+        // Solve the MCKP over the components, unless this cut assignment was already evaluated
+        if (batch) {
+            // The best moves of the scan are evaluated alongside the accepted one
+            std::sort(scanned.begin(), scanned.end(), [logq](ScannedMove const &lhs, ScannedMove const &rhs) {
+                return is_better_move(lhs.value, lhs.weight, rhs.value, rhs.weight, logq);
+            });
+            vector<pair<int, int> > moves;
+            for (int m = 0; m < scanned.size() && m < GlobalSearchOptions::batch_size; m++)
+                moves.push_back(make_pair(scanned[m].variable, scanned[m].value_index));
+            current = evaluate_batch(mn_c, logq, s, previous, moves);
+        } else {
+            current = evaluate_cut_assignment(mn_c, logq, d, use_cache ? &cache : nullptr, cut_hash, assignment, best_prob);
+        }
+        s.evaluations++;
+        if (current.feasible)
+            s.feasible_evaluations++;
+        if (current.feasible && current.value > best_prob){
+            best_prob = current.value;
+            get_assignment(s.best_assignment);
+        }
+        // In a sweep the solution read off for this q may beat the one of the MCKP
+        if (d.sweep != nullptr && d.sweep->values[d.sweep->current] > best_prob) {
+            best_prob = d.sweep->values[d.sweep->current];
+            s.best_assignment = d.sweep->assignments[d.sweep->current];
+        }
+        s.gap_closed = is_gap_closed(best_prob, s.upper_bound);
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - slice_start).count();
+        if (Telemetry::enabled)
+            write_telemetry(*this, mn_c, logq, s, s.seconds_used + elapsed, elapsed >= seconds || s.gap_closed);
+        // Time is reported per k, counting only the slices in which this k was searched
+        long long curr_time = (long long) (s.seconds_used + elapsed);
+        // A slice, which a closed gap also ends, writes a row unless the last one has its time and
+        // best value, so that every k has a row and the last row of a k dropped or finished is its final best
+        bool slice_end = elapsed >= seconds || s.gap_closed;
+        if ((curr_time % GlobalSearchOptions::print_interval == 0 && s.write_time != curr_time) ||
+            (slice_end && (s.write_time != curr_time || s.write_best != best_prob))) {
+            s.write_time = curr_time;
+            s.write_best = best_prob;
+
+            out1 << logq << "," << s.k << "," <<  best_prob << ',' << curr_time << "\n";
+            cerr << std::setprecision(20) <<logq << "," << s.k << "," <<  best_prob << ',' << num_assignments_explored<<","<<curr_time;
+            if (s.upper_bound != std::numeric_limits<long double>::max())
+                cerr << "," << s.upper_bound << "," << (s.upper_bound - best_prob) / fabsl(best_prob);
+            cerr << "\n";
+        }
+        if (slice_end) {
+            break;
+        }
+    }
+    s.seconds_used += elapsed;
+    get_assignment(assignment);
+}
+
+void MN::finish_search(SearchState& s, Decomposition* keep)
+{
+    if (GlobalSearchOptions::cache_size > 0) {
+        cout<<"Cut assignments evaluated = "<<s.cache.lookups<<endl;
+        cout<<"Cache hits = "<<s.cache.hits<<endl;
+        cout<<"Revisit rate = "<<(s.cache.lookups > 0 ? (double) s.cache.hits / s.cache.lookups : 0.0)<<endl;
+    }
+    if (s.lns_steps > 0) {
+        cout<<"LNS steps = "<<s.lns_steps<<", improving = "<<s.lns_improvements
+            <<", average group size = "<<(double) s.lns_group_sizes / s.lns_steps<<endl;
+    }
+    if (GlobalSearchOptions::screen) {
+        // Workers screen the candidates they evaluate
+        long long checks = s.d.screen_checks, infeasible = s.d.screened_infeasible, dominated = s.d.screened_dominated;
+        for (auto worker : s.workers) {
+            checks += worker->d.screen_checks;
+            infeasible += worker->d.screened_infeasible;
+            dominated += worker->d.screened_dominated;
+        }
+        cout<<"Screened evaluations = "<<checks<<", infeasible = "<<infeasible<<", dominated = "<<dominated<<endl;
+        cout<<"Prune rate = "<<(checks > 0 ? (double) (infeasible + dominated) / checks : 0.0)<<endl;
+    }
+    if (s.batch_steps > 0) {
+        cout<<"Batches = "<<s.batch_steps<<", workers = "<<s.workers.size()
+            <<", alternatives taken = "<<s.batch_alternatives_taken<<endl;
+    }
+    delete s.pool;
+    for (auto worker : s.workers)
+        delete_worker(worker);
+    if (keep != nullptr)
+        *keep = std::move(s.d);
+    // Release the decomposition, unless it is kept for another q, and the cache of this k
+    int k = s.k;
+    long double best_prob = s.best_prob;
+    s = SearchState();
+    s.k = k;
+    s.best_prob = best_prob;
+}
+
+static bool has_better_search(const SearchState* lhs, const SearchState* rhs)
+{
+    return lhs->best_prob > rhs->best_prob;
+}
+
+// Warn if the best assignment does not have the value recorded for it or violates the constraint,
+// without changing the values of the variables
+static void check_best_assignment(MN& mn, MN& mn_c, long double logq, const vector<int>& assignment, long double value)
+{
+    if (assignment.empty())
+        return;
+    vector<int> current;
+    mn.get_assignment(current);
+    mn.set_assignment(assignment);
+    long double weight = mn.getValue();
+    long double actual = mn_c.getValue();
+    mn.set_assignment(current);
+    long double tolerance = 1e-9 * std::max((long double) 1.0, fabsl(value));
+    if (fabsl(actual - value) > tolerance || weight > logq + tolerance)
+        cerr << std::setprecision(20) << "Warning: the best assignment has value " << actual << " and weight " << weight
+             << ", not value " << value << " within q = " << logq << "\n";
+}
+
+long double MN::run_experiments_neurips(MN& mn_c, long double logq, int k, ostream& out1, int max_time, vector<int>* best_assignment_out,
+                                        long double upper_bound){
+    //creating a graphical model from the original one
+    //Uncomment the following line if you want to generate knapsack networks randomly
+    //this->create_knapsack(mn_c);
+    //MN_constructed mn_c(potentials, variables);
+    long double best_prob = -1 * std::numeric_limits<long double>::max();
+    vector<int> best_assignment;
+    out1.precision(20);
+    //run for all values less than k
+    vector<SearchState> states;
+    for (int h = 1; h < k+1; h +=2) {
+        states.emplace_back();
+        states.back().k = h;
+    }
+    bool gap_closed = false;
+    vector<int> no_warm_start;
+    if (GlobalSearchOptions::schedule == 0) {
+        // Every k is searched for max_time seconds, one after the other
+        for (int a = 0; a < states.size(); a++) {
+            start_search(mn_c, logq, states[a].k, states[a], GlobalSearchOptions::warm_start ? best_assignment : no_warm_start);
+            states[a].upper_bound = upper_bound;
+            search(mn_c, logq, states[a], max_time, out1);
+            if (states[a].best_prob > best_prob) {
+                best_prob = states[a].best_prob;
+                best_assignment = states[a].best_assignment;
+            }
+            gap_closed = states[a].gap_closed;
+            finish_search(states[a]);
+            if (gap_closed) {
+                cout<<"Gap closed: stopping at K = "<<states[a].k<<endl;
+                break;
+            }
+        }
+        check_best_assignment(*this, mn_c, logq, best_assignment, best_prob);
+        if (best_assignment_out != nullptr)
+            *best_assignment_out = best_assignment;
+        return best_prob;
+    }
+    // Successive halving: the total budget of max_time seconds per k is split into rounds of
+    // equal length; after each round the worse half of the remaining values of k is dropped
+    // so that later rounds go to the values of k that found the best solutions
+    double total_time = (double) max_time * states.size();
+    double used_time = 0.0;
+    vector<SearchState*> alive;
+    for (int a = 0; a < states.size(); a++)
+        alive.push_back(&states[a]);
+    int num_rounds = 1;
+    while ((1 << (num_rounds - 1)) < alive.size())
+        num_rounds++;
+    for (int r = 0; r < num_rounds; r++) {
+        double slice = (total_time - used_time) / (num_rounds - r) / alive.size();
+        for (int a = 0; a < alive.size(); a++) {
+            SearchState& s = *alive[a];
+            if (!s.started) {
+                start_search(mn_c, logq, s.k, s, GlobalSearchOptions::warm_start ? best_assignment : no_warm_start);
+                s.upper_bound = upper_bound;
+            }
+            double before = s.seconds_used;
+            search(mn_c, logq, s, slice, out1);
+            used_time += s.seconds_used - before;
+            if (s.best_prob > best_prob) {
+                best_prob = s.best_prob;
+                best_assignment = s.best_assignment;
+            }
+            if (s.gap_closed) {
+                cout<<"Gap closed: stopping at K = "<<s.k<<endl;
+                gap_closed = true;
                 break;
             }
         }
+        if (r == num_rounds - 1 || gap_closed)
+            break;
+        std::stable_sort(alive.begin(), alive.end(), has_better_search);
+        int survivors = (alive.size() + 1) / 2;
+        for (int a = survivors; a < alive.size(); a++)
+            finish_search(*alive[a]);
+        alive.resize(survivors);
     }
+    for (int a = 0; a < alive.size(); a++)
+        finish_search(*alive[a]);
+    check_best_assignment(*this, mn_c, logq, best_assignment, best_prob);
+    if (best_assignment_out != nullptr)
+        *best_assignment_out = best_assignment;
     return best_prob;
 };
 
-
-
+void MN::run_sweep(MN& mn_c, const vector<long double>& logqs, int k, ostream& out1, int max_time, vector<long double>& best_values,
+                   vector<vector<int> >* best_assignments)
+{
+    // Every q is searched for max_time seconds for each k. The decomposition of k and its
+    // component tables are kept from one q to the next, and every MCKP solved for one q is
+    // also solved along its LP relaxation path for all the others
+    SweepIncumbents sweep;
+    sweep.logqs = logqs;
+    sweep.values = vector<long double>(logqs.size(), -1 * std::numeric_limits<long double>::max());
+    sweep.assignments = vector<vector<int> >(logqs.size());
+    sweep.updates = 0;
+    out1.precision(20);
+    vector<int> no_warm_start;
+    for (int h = 1; h < k+1; h +=2) {
+        Decomposition shared;
+        for (int j = 0; j < logqs.size(); j++) {
+            SearchState s;
+            s.d = std::move(shared);
+            start_search(mn_c, logqs[j], h, s, GlobalSearchOptions::warm_start ? sweep.assignments[j] : no_warm_start);
+            sweep.current = j;
+            s.d.sweep = &sweep;
+            if (sweep.values[j] > s.best_prob) {
+                s.best_prob = sweep.values[j];
+                s.best_assignment = sweep.assignments[j];
+            }
+            search(mn_c, logqs[j], s, max_time, out1);
+            // The best solution for this q is feasible for every larger q
+            for (int i = 0; i < logqs.size(); i++) {
+                if (logqs[i] >= logqs[j] && s.best_prob > sweep.values[i]) {
+                    sweep.values[i] = s.best_prob;
+                    sweep.assignments[i] = s.best_assignment;
+                }
+            }
+            s.d.sweep = nullptr;
+            finish_search(s, &shared);
+        }
+    }
+    cout<<"Solutions improved from the search for another q = "<<sweep.updates<<endl;
+    for (int j = 0; j < logqs.size(); j++)
+        check_best_assignment(*this, mn_c, logqs[j], sweep.assignments[j], sweep.values[j]);
+    best_values = sweep.values;
+    if (best_assignments != nullptr)
+        *best_assignments = sweep.assignments;
+}
@@ -34,10 +34,36 @@
 #include <iostream>
 #include <vector>
 #include <cstdlib>
+#include <limits>
+#include <memory>
+#include <unordered_map>
+#include <algorithm>
+#include <iterator>
+#include <random>
 
 using namespace std;
 struct GlobalSearchOptions{
     static int print_interval;
+    // Tabu tenure in iterations; 0 keeps the random escape from local maxima
+    static int tabu_tenure;
+    // Allow tabu moves that improve on the best feasible solution
+    static bool tabu_aspiration;
+    // Number of slots in the cache of evaluated cut assignments; 0 disables the cache
+    static int cache_size;
+    // Maximum number of cut variables re-optimized jointly by LNS; 0 disables LNS
+    static int lns_size;
+    // 0: every k is searched for max_time seconds; 1: successive halving over the values of k
+    static int schedule;
+    // Start the search for each k from the best assignment found so far instead of a random one
+    static bool warm_start;
+    // Relative gap (upper bound - best) / |best| at which a proof of optimality may stop
+    static long double gap;
+    // Skip the MCKP of cut assignments that bounds show to be infeasible or no better than the best
+    static bool screen;
+    // Candidate cut assignments evaluated concurrently per search step; 0 or 1 evaluates only the accepted move
+    static int batch_size;
+    // Max items of a component bin built by Pareto beam search instead of the full joint table; 0 for full tables
+    static int beam_size;
 };
 
 /*
@@ -70,9 +96,10 @@ struct Variable {
     /*
      * Useful Static Functions
      */
-    inline static int getAddress(const vector<Variable*>& variables){
-        int add_ress = 0;
-        int multiplier = 1;
+    // Addresses are 64-bit so that large scopes do not overflow
+    inline static long long getAddress(const vector<Variable*>& variables){
+        long long add_ress = 0;
+        long long multiplier = 1;
         for (auto variable : variables) {
             add_ress += (multiplier * variable->value);
             multiplier *= variable->domain_size;
@@ -80,15 +107,15 @@ struct Variable {
         return add_ress;
     }
 
-    inline static int getDomainSize(const vector<Variable*>& variables) {
-        int domain_size = 1;
+    inline static long long getDomainSize(const vector<Variable*>& variables) {
+        long long domain_size = 1;
         for (auto variable : variables)
             domain_size *= variable->domain_size;
         return domain_size;
     }
     // Get the maximum domain size of the set of variables
-    inline static void setAddress(const vector<Variable*>& variables, const int add_ress_) {
-        int add_ress = add_ress_;
+    inline static void setAddress(const vector<Variable*>& variables, const long long add_ress_) {
+        long long add_ress = add_ress_;
         for (auto variable : variables) {
             variable->value = add_ress % variable->domain_size;
             add_ress /= variable->domain_size;
@@ -96,6 +123,121 @@ struct Variable {
     }
 };
 
+/*
+ * Entries of a table together with statistics computed once when it is created:
+ * min and max:  smallest and largest entries (0 for an empty table)
+ * forbidden:    number of -inf entries (zeros of the UAI file, see hard_constraints)
+ * Tables with few distinct runs of equal consecutive entries (noisy-OR or context-specific
+ * tables, whose runs follow the address order) are stored run-length encoded instead of densely:
+ * run r holds run_values[r] at the addresses run_starts[r] to run_starts[r + 1] - 1, and values
+ * is empty. The form is chosen by the constructor of TableData, see compress_min_size and
+ * compress_ratio.
+ */
+struct TableData {
+    vector<long double> values;
+    vector<long long> run_starts;
+    vector<long double> run_values;
+    long long size;
+    long double min;
+    long double max;
+    long long forbidden;
+    explicit TableData(vector<long double>&& values_);
+    inline bool compressed() const { return !run_starts.empty(); }
+    // Run containing address i; hint is a run to try first, such as the run of the previous lookup
+    inline int run(long long i, int hint = 0) const {
+        if (hint < run_starts.size() && run_starts[hint] <= i && (hint + 1 == run_starts.size() || i < run_starts[hint + 1]))
+            return hint;
+        return std::upper_bound(run_starts.begin(), run_starts.end(), i) - run_starts.begin() - 1;
+    }
+    bool operator==(const TableData& other) const;
+    size_t hash() const;
+    // A table is compressed when it has at least this many entries and its runs take at most
+    // this fraction of the memory of its dense form
+    static const long long compress_min_size = 64;
+    static constexpr double compress_ratio = 0.25;
+};
+
+/*
+ * Immutable table of a potential. Potentials with the same entries may share one TableData
+ * (see TablePool), so copying a table is cheap; a table is changed by assigning it a new vector.
+ */
+struct Table {
+    std::shared_ptr<const TableData> data;
+    // Cached from data for the lookups of getValue; null for a compressed table
+    const long double* entries;
+    long long count;
+    Table() : entries(nullptr), count(0) {}
+    Table(vector<long double> values) : data(std::make_shared<const TableData>(std::move(values))) {
+        entries = data->compressed() ? nullptr : data->values.data();
+        count = data->size;
+    }
+    explicit Table(const std::shared_ptr<const TableData>& data_) : data(data_) {
+        entries = data->compressed() ? nullptr : data->values.data();
+        count = data->size;
+    }
+    inline long long size() const { return count; }
+    inline bool empty() const { return count == 0; }
+    inline bool compressed() const { return entries == nullptr && count > 0; }
+    inline long double operator[](long long i) const {
+        return entries != nullptr ? entries[i] : data->run_values[data->run(i)];
+    }
+    // Lookup for addresses visited in increasing order: hint keeps the run of the last lookup
+    inline long double at(long long i, int& hint) const {
+        if (entries != nullptr)
+            return entries[i];
+        hint = data->run(i, hint);
+        return data->run_values[hint];
+    }
+    // Iterates over the entries of the table in address order, dense or compressed
+    struct const_iterator {
+        typedef std::forward_iterator_tag iterator_category;
+        typedef long double value_type;
+        typedef long long difference_type;
+        typedef const long double* pointer;
+        typedef long double reference;
+        const Table* table;
+        long long i;
+        int hint;
+        long double operator*() const { return table->entries != nullptr ? table->entries[i] : table->data->run_values[hint]; }
+        const_iterator& operator++() {
+            i++;
+            if (table->entries == nullptr && hint + 1 < table->data->run_starts.size() && i == table->data->run_starts[hint + 1])
+                hint++;
+            return *this;
+        }
+        bool operator!=(const const_iterator& other) const { return i != other.i; }
+        bool operator==(const const_iterator& other) const { return i == other.i; }
+    };
+    const_iterator begin() const { return const_iterator{this, 0, 0}; }
+    const_iterator end() const { return const_iterator{this, count, 0}; }
+    // Dense copy of the entries
+    vector<long double> values() const {
+        if (entries != nullptr || !data)
+            return data ? data->values : vector<long double>();
+        vector<long double> values(count);
+        for (int r = 0; r < data->run_starts.size(); r++) {
+            long long last = r + 1 < data->run_starts.size() ? data->run_starts[r + 1] : count;
+            std::fill(values.begin() + data->run_starts[r], values.begin() + last, data->run_values[r]);
+        }
+        return values;
+    }
+    long double min() const { return data ? data->min : 0.0; }
+    long double max() const { return data ? data->max : 0.0; }
+    long long forbidden() const { return data ? data->forbidden : 0; }
+    // Number of tables sharing these entries
+    long references() const { return data.use_count(); }
+};
+
+/*
+ * Hash-consing of tables: intern returns a table sharing the entries of any live table with the
+ * same entries. The pool only holds weak references, so it does not keep replaced tables alive.
+ */
+struct TablePool {
+    std::unordered_map<size_t, vector<std::weak_ptr<const TableData> > > buckets;
+    Table intern(vector<long double>&& values);
+    Table intern(const Table& table);
+};
+
 /*
  * Note that all potentials are log-potentials.
  * A log-potential is a pair <X,table> where
@@ -105,29 +247,282 @@ struct Variable {
 struct Potential
 {
     vector<Variable*> variables;
-    vector<long double> table;
+    Table table;
     Potential()= default;
     long double getValue() {
         return table[Variable::getAddress(variables)];
     }
     Potential(const vector <Potential*>& potentials, const vector<Variable*>&component_variables) {
         variables = component_variables;
-        int num_values = Variable::getDomainSize(variables);
-        table = vector<long double>(num_values, 0.0);
-        for (int i = 0; i < num_values; i++) {
+        long long num_values = Variable::getDomainSize(variables);
+        vector<long double> values(num_values, 0.0);
+        // Compressed tables are read without expanding them, resuming from the run of the
+        // previous lookup
+        vector<int> hints(potentials.size(), 0);
+        for (long long i = 0; i < num_values; i++) {
             Variable::setAddress(component_variables, i);
-            for (auto & potential : potentials)
-                table[i] += potential->getValue();
+            for (int p = 0; p < potentials.size(); p++)
+                values[i] += potentials[p]->table.at(Variable::getAddress(potentials[p]->variables), hints[p]);
         }
+        table = std::move(values);
+    }
+};
+
+/*
+ * Result of solving the component MCKP for one assignment to the cut variables
+ * value:      objective of the MCKP solution plus the value of the cut potentials
+ * min_weight: smallest weight of any completion of the cut assignment
+ * feasible:   whether min_weight satisfies the constraint
+ * screened:   the MCKP was skipped because bounds showed the assignment infeasible or
+ *             no better than the best solution; value is then -max and min_weight a lower bound
+ */
+struct CutEvaluation {
+    long double value;
+    long double min_weight;
+    bool feasible;
+    bool screened;
+    CutEvaluation() : value(0.0), min_weight(0.0), feasible(false), screened(false) {}
+};
+
+/*
+ * Direct-mapped cache of evaluated cut assignments.
+ * An assignment to the cut variables is identified by its Zobrist hash, the xor of one
+ * random key per (cut variable, value) pair, which is updated in O(1) when a cut variable
+ * changes. Each slot stores the MCKP result for the assignment together with the selected
+ * entry of every component table (the values of the component variables for bounded bins,
+ * whose items depend on the cut values) so that a revisit costs a single lookup.
+ */
+struct CutCache {
+    struct Entry {
+        unsigned long long key;
+        bool valid;
+        CutEvaluation evaluation;
+        vector<long long> solution;
+        Entry() : key(0), valid(false) {}
+    };
+    // keys[j][d]: key of value d of the j-th cut variable
+    vector<vector<unsigned long long> > keys;
+    vector<Entry> entries;
+    long long lookups;
+    long long hits;
+    CutCache() : lookups(0), hits(0) {}
+    void init(const vector<Variable*>& cut_variables, int size);
+    unsigned long long hash(const vector<Variable*>& cut_variables) const;
+    inline unsigned long long move(unsigned long long key, int j, int old_value, int new_value) const {
+        return key ^ keys[j][old_value] ^ keys[j][new_value];
     }
+    Entry* find(unsigned long long key);
+    void store(unsigned long long key, const CutEvaluation& evaluation, const vector<long long>& solution);
+};
+
+/*
+ * Best solution found for every q of a sweep. Every cut assignment evaluated while searching
+ * for the current q also yields, from the same component tables, a solution for every other q.
+ */
+struct SweepIncumbents {
+    vector<long double> logqs;
+    vector<long double> values;
+    vector<vector<int> > assignments;
+    // Index of the q being searched
+    int current;
+    // Number of incumbents improved while searching for another q
+    long long updates;
+};
+
+/*
+ * A k-separator decomposition of the pair of networks.
+ * cut_variables:       the k-separator
+ * components:          variables of each component left after removing the cut variables
+ * buckets:             potentials of each component; the last bucket holds the potentials
+ *                      defined over cut variables only
+ * component_cuts:      indices of the cut variables that condition each component
+ * cut_components:      components conditioned by each cut variable
+ * cut_neighbours:      cut variables that interact with each cut variable, either through a
+ *                      potential or through a common component
+ * weight/value_tables: joint tables of each component, conditioned on the cut variables
+ *                      whose values are recorded in built_cut_values. With a beam size the
+ *                      tables hold only the items of the bounded bin instead
+ * beam_assignments:    values of the component variables for every item of a bounded bin
+ * min_weights:         smallest entry of each weight table
+ * max_values:          largest entry of each value table
+ * bound_weights/values: lower bound on the weight and upper bound on the value of each
+ *                      component for the cut values in bound_cut_values, from its potentials
+ *                      taken separately; used to screen cut assignments without building tables
+ * sweep:               incumbents of a sweep over several q updated by every MCKP solved, or nullptr
+ */
+struct Decomposition {
+    vector<Variable*> cut_variables;
+    // is_cut[v]: variable v is a cut variable
+    vector<bool> is_cut;
+    vector<set<int> > components;
+    vector<set<int> > buckets;
+    vector<vector<Variable*> > component_variables;
+    vector<vector<int> > component_cuts;
+    vector<vector<int> > cut_components;
+    vector<set<int> > cut_neighbours;
+    // Potentials over cut variables only that mention each cut variable
+    vector<vector<int> > cut_potentials;
+    vector<Potential> weight_tables;
+    vector<Potential> value_tables;
+    vector<vector<vector<int> > > beam_assignments;
+    vector<bool> built;
+    vector<vector<int> > built_cut_values;
+    vector<long double> min_weights;
+    vector<long double> max_values;
+    vector<long double> bound_weights;
+    vector<long double> bound_values;
+    vector<vector<int> > bound_cut_values;
+    // Running average of the time taken by one component build and MCKP solve
+    double eval_seconds;
+    // Evaluations checked against the bounds and those skipped as infeasible or dominated
+    long long screen_checks;
+    long long screened_infeasible;
+    long long screened_dominated;
+    // MCKPs solved over the components
+    long long mckp_calls;
+    SweepIncumbents* sweep;
+    // Generator of the local search of the MCKP solver; rand() if null, as on the search thread
+    std::mt19937* generator;
+    Decomposition() : eval_seconds(0.0), screen_checks(0), screened_infeasible(0), screened_dominated(0), mckp_calls(0),
+                      sweep(nullptr), generator(nullptr) {}
+};
+
+struct SearchWorker;
+struct WorkerPool;
+
+/*
+ * Local search for one k-separator. The state is kept between time slices so that the
+ * search time can be shared between the values of k.
+ */
+struct SearchState {
+    int k;
+    bool started;
+    Decomposition d;
+    CutCache cache;
+    unsigned long long cut_hash;
+    vector<int> tabu_until;
+    CutEvaluation current;
+    // Value of every variable when the search was paused
+    vector<int> assignment;
+    long double best_prob;
+    vector<int> best_assignment;
+    int num_assignments_explored;
+    double seconds_used;
+    // Time and best value of the last row written to the output (infinity before the first row)
+    long long write_time;
+    long double write_best;
+    long long lns_steps;
+    long long lns_improvements;
+    long long lns_group_sizes;
+    // Proven upper bound on the optimal value, used to stop once the gap is closed
+    long double upper_bound;
+    bool gap_closed;
+    // Copies of the networks used to evaluate a batch of candidates concurrently, and the
+    // threads evaluating them, one per worker
+    vector<SearchWorker*> workers;
+    WorkerPool* pool;
+    long long batch_steps;
+    long long batch_alternatives_taken;
+    // Cut assignments evaluated and those found feasible
+    long long evaluations;
+    long long feasible_evaluations;
+    // Telemetry: MCKPs of the decomposition solved before this search, time, iterations and
+    // MCKPs of the last status record, and best value and weight of the last incumbent record
+    long long mckp_calls_base;
+    double telemetry_time;
+    int telemetry_iterations;
+    long long telemetry_mckp_calls;
+    long double telemetry_best;
+    long double best_weight;
+    SearchState() : k(0), started(false), cut_hash(0), best_prob(-1 * std::numeric_limits<long double>::max()),
+                    num_assignments_explored(0), seconds_used(0.0), write_time(0),
+                    write_best(std::numeric_limits<long double>::infinity()), lns_steps(0), lns_improvements(0),
+                    lns_group_sizes(0), upper_bound(std::numeric_limits<long double>::max()), gap_closed(false),
+                    pool(nullptr), batch_steps(0), batch_alternatives_taken(0), evaluations(0), feasible_evaluations(0),
+                    mckp_calls_base(0), telemetry_time(0.0), telemetry_iterations(0), telemetry_mckp_calls(0),
+                    telemetry_best(-1 * std::numeric_limits<long double>::max()),
+                    best_weight(std::numeric_limits<long double>::max()) {}
+};
+
+/*
+ * Outcome of branch and bound: the best solution found and a proven upper bound on the
+ * optimal value. complete is false if the node or time limit stopped the search.
+ */
+struct BranchAndBoundResult {
+    long double lower_bound;
+    long double upper_bound;
+    vector<int> assignment;
+    long long nodes;
+    bool complete;
+    double seconds;
+};
+
+/*
+ * Lagrangian dual bound on CMPE
+ * bound:         smallest L(lambda) found, an upper bound on the optimal value
+ * lambda:        multiplier at which the bound was attained
+ * primal:        best feasible value among the decoded maximizers (lowest long double if none)
+ * exact:         whether every inner maximization was solved exactly
+ * induced_width: width of the elimination ordering of the combined network
+ */
+struct LagrangianResult {
+    long double bound;
+    long double lambda;
+    long double primal;
+    vector<int> assignment;
+    bool exact;
+    int induced_width;
+    int evaluations;
+    double seconds;
+};
+
+/*
+ * Result of the bi-objective bucket elimination: the (weight, value) frontier of the whole
+ * network, sorted by weight, which answers the problem for every q, and the answer for each
+ * logq: its value (lowest long double if infeasible) and an assignment (empty if infeasible).
+ * With epsilon > 0 every value is within a factor (1+epsilon) of the optimal one; weights are exact.
+ */
+struct ParetoResult {
+    vector<pair<long double, long double> > frontier;
+    vector<long double> values;
+    vector<vector<int> > assignments;
+    // False if the induced width exceeded the limit and nothing was computed
+    bool complete;
+    int induced_width;
+    long long max_frontier;
+    double seconds;
 };
 
 struct MN{
     vector<Variable*> variables;
     vector<Potential*> potentials;
+    // With evidence: the variables of the UAI file, observed or not, and the observed value of
+    // each (-1 if unobserved); variables holds only the unobserved ones, renumbered
+    vector<Variable*> uai_variables;
+    vector<int> evidence;
+    // Once domains are reduced: for every variable of the UAI file, the UAI value of each of its
+    // remaining values (empty if its domain is unchanged)
+    vector<vector<int> > value_maps;
+    // Tables of the potentials read, shared by potentials with the same entries
+    TablePool table_pool;
+    // After reorder: the index of every variable and of every potential before reordering
+    // (empty if the network was not reordered)
+    vector<int> variable_order;
+    vector<int> potential_order;
     MN(){}
-    void readMN(string filename_);
+    void readMN(string filename_, string evidence_filename_="");
     void readMN2(string filename_,MN& mn1);
+    vector<int> read_evidence(string filename_);
+    void condition(const vector<int>& evidence_);
+    void expand_assignment(const vector<int>& values, vector<int>& uai_values);
+    bool reduce_assignment(const vector<int>& uai_values, vector<int>& values);
+    void presolve(MN& mn_c);
+    void restrict_domains(MN& mn_c, const vector<vector<bool> >& alive);
+    void hard_constraints(MN& mn_c);
+    void share_tables(MN& mn_c);
+    void reorder(MN& mn_c);
+    inline int original_variable(int v) { return variable_order.empty() ? v : variable_order[v]; }
+    inline int original_potential(int i) { return potential_order.empty() ? i : potential_order[i]; }
 
     inline long double getValue(){long double logp=0.0;for(int i=0;i<potentials.size();i++) logp+=potentials[i]->getValue(); return logp;}
 
@@ -136,7 +531,54 @@ struct MN{
     vector <set<int>> connectedComponents(vector <set<int>> adj);
     vector <set<int>> generate_buckets(vector <set<int>>& components);
     bool knapsack_greedy(long double logq, vector<Potential>& functions, vector<Potential>& functions_c, vector<int>& var_assignment, long double& best_prob);
-    long double run_experiments_neurips(MN& mn_c, long double logq, int k=15, ostream& out1=cout, int max_time=1200);
+    vector <set<int>> primal_graph();
+    void decompose(int k, Decomposition& d);
+    void build_component_tables(MN& mn_c, Decomposition& d, int i);
+    void build_component_beam(MN& mn_c, Decomposition& d, int i);
+    // Solve the MCKP over the components conditioned on the current cut assignment
+    CutEvaluation solve_components(MN& mn_c, long double logq, Decomposition& d, vector<int>& assignment, vector<long long>& solution);
+    static void restore_components(Decomposition& d, const vector<long long>& solution, vector<int>& assignment);
+    bool screen_cut_assignment(MN& mn_c, long double logq, Decomposition& d, long double threshold, CutEvaluation& evaluation);
+    CutEvaluation evaluate_cut_assignment(MN& mn_c, long double logq, Decomposition& d, CutCache* cache, unsigned long long key,
+                                          vector<int>& assignment, long double threshold);
+    bool lns_move(MN& mn_c, long double logq, Decomposition& d, CutCache* cache, unsigned long long& key, vector<int>& assignment,
+                  const CutEvaluation& current, long double& best_prob, vector<int>& best_assignment, double remaining_seconds,
+                  int& group_size);
+    void get_assignment(vector<int>& values);
+    void set_assignment(const vector<int>& values);
+    void start_search(MN& mn_c, long double logq, int k, SearchState& s, const vector<int>& warm_start);
+    CutEvaluation evaluate_batch(MN& mn_c, long double logq, SearchState& s, const vector<int>& previous,
+                                 const vector<pair<int, int> >& moves);
+    void search(MN& mn_c, long double logq, SearchState& s, double seconds, ostream& out1);
+    void finish_search(SearchState& s, Decomposition* keep=nullptr);
+    long double run_experiments_neurips(MN& mn_c, long double logq, int k=15, ostream& out1=cout, int max_time=1200,
+                                        vector<int>* best_assignment=nullptr,
+                                        long double upper_bound=std::numeric_limits<long double>::max());
+    void run_sweep(MN& mn_c, const vector<long double>& logqs, int k, ostream& out1, int max_time, vector<long double>& best_values,
+                   vector<vector<int> >* best_assignments=nullptr);
+    vector<int> min_fill_ordering(int& induced_width);
+    long long mini_bucket_entries(const vector<Potential*>& functions, const vector<int>& order, int i_bound, long long max_entries);
+    long double max_sum_elimination(const vector<Potential*>& functions, const vector<int>& order, int i_bound,
+                                    vector<int>& assignment, bool& exact);
+    LagrangianResult lagrangian_bound(MN& mn_c, long double logq, int i_bound, int num_iterations=40);
+    ParetoResult pareto_elimination(MN& mn_c, const vector<long double>& logqs, long double epsilon, int max_width);
+    BranchAndBoundResult branch_and_bound(MN& mn_c, long double logq, int k, long double incumbent, const vector<int>& incumbent_assignment,
+                                          double time_limit, long long node_limit);
     void writeMPS(MN& mn_c, long double logp, ostream &out1=cout);
+    void writeCompactMPS(MN& mn_c, long double logp, ostream &out1=cout);
+    void writeMILP(MN& mn_c, long double logp, bool compact, bool lp, const string& filename);
+    void writeMIPStart(MN& mn_c, bool compact, const vector<int>& assignment, const string& filename);
+};
+
+/*
+ * Private copy of the pair of networks and of the decomposition for one thread evaluating
+ * candidate cut assignments; the value network shares the variables of the weight network
+ */
+struct SearchWorker {
+    MN mn;
+    MN mn_c;
+    Decomposition d;
+    // Reseeded for every candidate so that the result does not depend on the worker
+    std::mt19937 generator;
 };
 #endif /* MN_H_ */
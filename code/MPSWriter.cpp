@@ -0,0 +1,510 @@
+/*
+ * MPSWriter.cpp
+ *
+ *
+ *      Authors: Sara Rouhani,Tahrima Rahman,Vibhav Gogate. The University of Texas at Dallas
+ *      Contacts: {sara.rouhani,tahrima.rahman,vibhav.gogate}@utdallas.edu
+ *
+ *      MIT License
+ *
+ *      Permission is hereby granted, free of charge, to any person obtaining a copy
+ *      of this software and associated documentation files (the "Software"), to deal
+ *      in the Software without restriction, including without limitation the rights
+ *      to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *      copies of the Software, and to permit persons to whom the Software is
+ *      furnished to do so, subject to the following conditions:
+ *
+ *      The above copyright notice and this permission notice shall be included in all
+ *      copies or substantial portions of the Software.
+ *
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *      AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *      LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *      OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *      SOFTWARE.
+ */
+
+#include <vector>
+#include <cstdio>
+#include <cmath>
+#include <limits>
+
+#include "MN.h"
+#include "StreamWriter.h"
+
+using namespace std;
+
+/*
+ * Name of a row or a column: a prefix followed by up to four indices, e.g. x3_1 for entry 1
+ * of potential 3. Names are generated from the indices so none has to be stored
+ */
+struct Name {
+    const char* prefix;
+    int count;
+    long long ids[4];
+    Name(const char* prefix_) : prefix(prefix_), count(0) {}
+    Name(const char* prefix_, long long a) : prefix(prefix_), count(1) { ids[0] = a; }
+    Name(const char* prefix_, long long a, long long b) : prefix(prefix_), count(2) { ids[0] = a; ids[1] = b; }
+    Name(const char* prefix_, long long a, long long b, long long c) : prefix(prefix_), count(3) {
+        ids[0] = a; ids[1] = b; ids[2] = c;
+    }
+    Name(const char* prefix_, long long a, long long b, long long c, long long d) : prefix(prefix_), count(4) {
+        ids[0] = a; ids[1] = b; ids[2] = c; ids[3] = d;
+    }
+    void write(StreamWriter& out) const {
+        out.put(prefix);
+        for (int i = 0; i < count; i++) {
+            if (i > 0)
+                out.put('_');
+            out.put(ids[i]);
+        }
+    }
+};
+
+/*
+ * Formulation of writeMPS: column x<i>_<e> is the indicator of entry e of potential i, row
+ * S<i> chooses one entry of potential i and rows P<a>_<i>_<j>_<d> make potentials i < j over
+ * variable a agree on its value, d being the value in potential i. Requires binary domains and value
+ * potentials over the scopes of the weight potentials. Entries of value -inf (hard constraints)
+ * get no column.
+ * Rows and columns are enumerated with their nonzeros for a visitor V providing
+ *      row(name, sense, rhs), column(name, integer), term(name, coefficient), end()
+ * and a flag terms telling whether the nonzeros are needed
+ */
+struct PairwiseFormulation {
+    MN& mn;
+    MN& mn_c;
+    long double logp;
+    vector<vector<int> > var2funcids;
+    PairwiseFormulation(MN& mn_, MN& mn_c_, long double logp_) : mn(mn_), mn_c(mn_c_), logp(logp_),
+            var2funcids(mn_.variables.size()) {
+        for (int i = 0; i < mn.potentials.size(); i++)
+            for (auto variable : mn.potentials[i]->variables)
+                var2funcids[variable->id].push_back(i);
+    }
+    // Row making potentials i and j agree on variable a, with value d in potential i; named by
+    // the numbering without -reorder, the smaller potential first
+    Name agreement(int a, int i, int j, int d) {
+        long long first = mn.original_potential(i), second = mn.original_potential(j);
+        if (first < second)
+            return Name("P", mn.original_variable(a), first, second, d);
+        return Name("P", mn.original_variable(a), second, first, 1 - d);
+    }
+    bool forbidden(int i, long long e) {
+        return mn_c.potentials[i]->table[e] == -std::numeric_limits<long double>::infinity();
+    }
+    template<class V>
+    void rows(V& out) {
+        out.row(Name("COST"), 'N', 0);
+        if (out.terms) {
+            for (int i = 0; i < mn_c.potentials.size(); i++)
+                for (long long e = 0; e < mn_c.potentials[i]->table.size(); e++)
+                    if (!forbidden(i, e))
+                        out.term(Name("x", mn.original_potential(i), e), -mn_c.potentials[i]->table[e]);
+        }
+        out.end();
+        out.row(Name("W"), 'L', logp);
+        if (out.terms) {
+            for (int i = 0; i < mn.potentials.size(); i++)
+                for (long long e = 0; e < mn.potentials[i]->table.size(); e++)
+                    if (!forbidden(i, e))
+                        out.term(Name("x", mn.original_potential(i), e), mn.potentials[i]->table[e]);
+        }
+        out.end();
+        for (int i = 0; i < mn.potentials.size(); i++) {
+            out.row(Name("S", mn.original_potential(i)), 'E', 1);
+            if (out.terms) {
+                for (long long e = 0; e < mn.potentials[i]->table.size(); e++)
+                    if (!forbidden(i, e))
+                        out.term(Name("x", mn.original_potential(i), e), 1);
+            }
+            out.end();
+        }
+        for (int a = 0; a < mn.variables.size(); a++) {
+            for (int b = 0; b < var2funcids[a].size(); b++) {
+                for (int c = b + 1; c < var2funcids[a].size(); c++) {
+                    for (int d = 0; d < 2; d++) {
+                        out.row(agreement(a, var2funcids[a][b], var2funcids[a][c], d), 'E', 1);
+                        if (out.terms) {
+                            agreeing_entries(out, var2funcids[a][b], a, d);
+                            agreeing_entries(out, var2funcids[a][c], a, 1 - d);
+                        }
+                        out.end();
+                    }
+                }
+            }
+        }
+    }
+    template<class V>
+    void agreeing_entries(V& out, int i, int a, int d) {
+        Potential* potential = mn.potentials[i];
+        for (long long e = 0; e < potential->table.size(); e++) {
+            Variable::setAddress(potential->variables, e);
+            if (mn.variables[a]->value == d && !forbidden(i, e))
+                out.term(Name("x", mn.original_potential(i), e), 1);
+        }
+    }
+    template<class V>
+    void columns(V& out) {
+        for (int i = 0; i < mn.potentials.size(); i++) {
+            Potential* potential = mn.potentials[i];
+            for (long long e = 0; e < potential->table.size(); e++) {
+                if (forbidden(i, e))
+                    continue;
+                out.column(Name("x", mn.original_potential(i), e), true);
+                if (out.terms) {
+                    out.term(Name("COST"), -mn_c.potentials[i]->table[e]);
+                    out.term(Name("W"), potential->table[e]);
+                    out.term(Name("S", mn.original_potential(i)), 1);
+                    Variable::setAddress(potential->variables, e);
+                    for (int l = 0; l < potential->variables.size(); l++) {
+                        int a = potential->variables[l]->id, value = potential->variables[l]->value;
+                        for (auto j : var2funcids[a])
+                            if (j != i)
+                                out.term(agreement(a, i, j, value), 1);
+                    }
+                }
+                out.end();
+            }
+        }
+    }
+};
+
+/*
+ * Formulation of writeCompactMPS: binary column y<v>_<d> for value d of variable v, row V<v>
+ * choosing one value, column x<i>_<e> in [0,1] for entry e of weight potential i and rows
+ * M<i>_<l>_<d> summing the entries of potential i with its l-th variable at value d to the
+ * indicator of that value. A value potential over another scope gets its own columns z<i>_<e>
+ * and rows N<i>_<l>_<d>. Entries of value -inf (hard constraints) get no column.
+ */
+struct CompactFormulation {
+    MN& mn;
+    MN& mn_c;
+    long double logp;
+    // (potential, position in the scope) of the occurrences of each variable; value
+    // potentials are numbered after the weight potentials
+    vector<vector<pair<int, int> > > occurrences;
+    CompactFormulation(MN& mn_, MN& mn_c_, long double logp_) : mn(mn_), mn_c(mn_c_), logp(logp_),
+            occurrences(mn_.variables.size()) {
+        for (int i = 0; i < 2 * mn.potentials.size(); i++) {
+            if (i < mn.potentials.size() || !shared(i - mn.potentials.size())) {
+                Potential* potential = get(i);
+                for (int l = 0; l < potential->variables.size(); l++)
+                    occurrences[potential->variables[l]->id].push_back(make_pair(i, l));
+            }
+        }
+    }
+    bool shared(int i) {
+        return mn_c.potentials[i]->variables == mn.potentials[i]->variables;
+    }
+    Potential* get(int i) {
+        return i < mn.potentials.size() ? mn.potentials[i] : mn_c.potentials[i - mn.potentials.size()];
+    }
+    // Entry e of potential i (value potentials numbered after the weight potentials) is forbidden
+    bool forbidden(int i, long long e) {
+        int n = mn.potentials.size();
+        if (i < n && !shared(i))
+            return false;
+        return mn_c.potentials[i % n]->table[e] == -std::numeric_limits<long double>::infinity();
+    }
+    Name entry(int i, long long e) {
+        return i < mn.potentials.size() ? Name("x", mn.original_potential(i), e) : Name("z", mn.original_potential(i - mn.potentials.size()), e);
+    }
+    Name marginal(int i, int l, int d) {
+        return i < mn.potentials.size() ? Name("M", mn.original_potential(i), l, d) : Name("N", mn.original_potential(i - mn.potentials.size()), l, d);
+    }
+    template<class V>
+    void rows(V& out) {
+        int n = mn.potentials.size();
+        out.row(Name("COST"), 'N', 0);
+        if (out.terms) {
+            for (int i = 0; i < n; i++)
+                for (long long e = 0; e < mn_c.potentials[i]->table.size(); e++)
+                    if (!forbidden(shared(i) ? i : n + i, e))
+                        out.term(entry(shared(i) ? i : n + i, e), -mn_c.potentials[i]->table[e]);
+        }
+        out.end();
+        out.row(Name("W"), 'L', logp);
+        if (out.terms) {
+            for (int i = 0; i < n; i++)
+                for (long long e = 0; e < mn.potentials[i]->table.size(); e++)
+                    if (!forbidden(i, e))
+                        out.term(entry(i, e), mn.potentials[i]->table[e]);
+        }
+        out.end();
+        for (int v = 0; v < mn.variables.size(); v++) {
+            out.row(Name("V", mn.original_variable(v)), 'E', 1);
+            if (out.terms) {
+                for (int d = 0; d < mn.variables[v]->domain_size; d++)
+                    out.term(Name("y", mn.original_variable(v), d), 1);
+            }
+            out.end();
+        }
+        for (int i = 0; i < 2 * n; i++) {
+            if (i >= n && shared(i - n))
+                continue;
+            Potential* potential = get(i);
+            for (int l = 0; l < potential->variables.size(); l++) {
+                Variable* variable = potential->variables[l];
+                for (int d = 0; d < variable->domain_size; d++) {
+                    out.row(marginal(i, l, d), 'E', 0);
+                    if (out.terms) {
+                        for (long long e = 0; e < potential->table.size(); e++) {
+                            Variable::setAddress(potential->variables, e);
+                            if (variable->value == d && !forbidden(i, e))
+                                out.term(entry(i, e), 1);
+                        }
+                        out.term(Name("y", mn.original_variable(variable->id), d), -1);
+                    }
+                    out.end();
+                }
+            }
+        }
+    }
+    template<class V>
+    void columns(V& out) {
+        int n = mn.potentials.size();
+        for (int v = 0; v < mn.variables.size(); v++) {
+            for (int d = 0; d < mn.variables[v]->domain_size; d++) {
+                out.column(Name("y", mn.original_variable(v), d), true);
+                if (out.terms) {
+                    out.term(Name("V", mn.original_variable(v)), 1);
+                    for (auto occurrence : occurrences[v])
+                        out.term(marginal(occurrence.first, occurrence.second, d), -1);
+                }
+                out.end();
+            }
+        }
+        for (int i = 0; i < 2 * n; i++) {
+            if (i >= n && shared(i - n))
+                continue;
+            Potential* potential = get(i);
+            for (long long e = 0; e < potential->table.size(); e++) {
+                if (forbidden(i, e))
+                    continue;
+                out.column(entry(i, e), false);
+                if (out.terms) {
+                    if (i >= n || shared(i))
+                        out.term(Name("COST"), -mn_c.potentials[i % n]->table[e]);
+                    if (i < n)
+                        out.term(Name("W"), potential->table[e]);
+                    Variable::setAddress(potential->variables, e);
+                    for (int l = 0; l < potential->variables.size(); l++)
+                        out.term(marginal(i, l, potential->variables[l]->value), 1);
+                }
+                out.end();
+            }
+        }
+    }
+};
+
+/*
+ * Free MPS: ROWS, RHS and BOUNDS come from enumerations without nonzeros and COLUMNS from
+ * the column-wise enumeration, with integer columns between INTORG and INTEND markers
+ */
+struct MPSVisitor {
+    StreamWriter& out;
+    bool terms;
+    int section;
+    bool integer_block;
+    Name current;
+    MPSVisitor(StreamWriter& out_) : out(out_), terms(false), section(0), integer_block(false), current("") {}
+    void row(const Name& name, char sense, long double rhs) {
+        if (section == 0) {
+            out.put(' ');
+            out.put(sense);
+            out.put(' ');
+            name.write(out);
+            out.put('\n');
+        } else if (sense != 'N' && rhs != 0) {
+            out.put(" RHS ");
+            name.write(out);
+            out.put(' ');
+            out.put(rhs);
+            out.put('\n');
+        }
+    }
+    void column(const Name& name, bool integer) {
+        if (section == 0 && integer != integer_block) {
+            out.put(integer ? " MARKER 'MARKER' 'INTORG'\n" : " MARKER 'MARKER' 'INTEND'\n");
+            integer_block = integer;
+        }
+        current = name;
+        if (section == 1) {
+            out.put(" UP BND ");
+            name.write(out);
+            out.put(" 1\n");
+        }
+    }
+    void term(const Name& name, long double coefficient) {
+        out.put(' ');
+        current.write(out);
+        out.put(' ');
+        name.write(out);
+        out.put(' ');
+        out.put(coefficient);
+        out.put('\n');
+    }
+    void end() {}
+};
+
+/*
+ * CPLEX LP: the objective and the constraints from the row-wise enumeration, the bounds and
+ * the binaries from the column-wise enumeration
+ */
+struct LPVisitor {
+    StreamWriter& out;
+    bool terms;
+    int section;
+    long double rhs;
+    char sense;
+    int written;
+    LPVisitor(StreamWriter& out_) : out(out_), terms(true), section(0), rhs(0), sense('N'), written(0) {}
+    void row(const Name& name, char sense_, long double rhs_) {
+        if (sense_ == 'N')
+            out.put("Minimize\n");
+        else if (sense == 'N')
+            out.put("Subject To\n");
+        sense = sense_;
+        rhs = rhs_;
+        written = 0;
+        out.put(' ');
+        name.write(out);
+        out.put(':');
+    }
+    void column(const Name& name, bool integer) {
+        if (section == 0 && !integer) {
+            out.put(' ');
+            name.write(out);
+            out.put(" <= 1\n");
+        } else if (section == 1 && integer) {
+            out.put(' ');
+            name.write(out);
+            out.put('\n');
+        }
+    }
+    void term(const Name& name, long double coefficient) {
+        // Keep lines short for readers limiting their length
+        if (written > 0 && written % 8 == 0)
+            out.put("\n  ");
+        out.put(coefficient < 0 ? " - " : " + ");
+        out.put(fabsl(coefficient));
+        out.put(' ');
+        name.write(out);
+        written++;
+    }
+    void end() {
+        // Only rows are enumerated with their nonzeros
+        if (!terms)
+            return;
+        if (sense == 'L') {
+            out.put(" <= ");
+            out.put(rhs);
+        } else if (sense == 'E') {
+            out.put(" = ");
+            out.put(rhs);
+        }
+        out.put('\n');
+    }
+};
+
+template<class F>
+void write_formulation(F& formulation, bool lp, StreamWriter& out) {
+    if (lp) {
+        LPVisitor visitor(out);
+        out.put("\\ CMPE\n");
+        formulation.rows(visitor);
+        visitor.terms = false;
+        out.put("Bounds\n");
+        formulation.columns(visitor);
+        visitor.section = 1;
+        out.put("Binaries\n");
+        formulation.columns(visitor);
+        out.put("End\n");
+    } else {
+        MPSVisitor visitor(out);
+        out.put("NAME CMPE\nROWS\n");
+        formulation.rows(visitor);
+        out.put("COLUMNS\n");
+        visitor.terms = true;
+        formulation.columns(visitor);
+        if (visitor.integer_block)
+            out.put(" MARKER 'MARKER' 'INTEND'\n");
+        visitor.terms = false;
+        visitor.section = 1;
+        out.put("RHS\n");
+        formulation.rows(visitor);
+        out.put("BOUNDS\n");
+        formulation.columns(visitor);
+        out.put("ENDATA\n");
+    }
+}
+
+// Write the pairwise (writeMPS) or the local-polytope (writeCompactMPS) formulation in free MPS
+// or in CPLEX LP format without building the model in memory
+void MN::writeMILP(MN& mn_c, long double logp, bool compact, bool lp, const string& filename) {
+    StreamWriter out(filename);
+    if (compact) {
+        CompactFormulation formulation(*this, mn_c, logp);
+        write_formulation(formulation, lp, out);
+    } else {
+        PairwiseFormulation formulation(*this, mn_c, logp);
+        write_formulation(formulation, lp, out);
+    }
+}
+
+/*
+ * MIP start: the value of every column for a full assignment, as "name value" lines read by
+ * Gurobi (.mst), SCIP and CBC (.sol). address[i] is the entry of potential i selected by the
+ * assignment, value potentials numbered after the weight potentials. Both are indexed as the
+ * names, by the indices before reorder
+ */
+struct StartVisitor {
+    StreamWriter& out;
+    bool terms;
+    vector<int> assignment;
+    vector<long long> address;
+    StartVisitor(StreamWriter& out_) : out(out_), terms(false) {}
+    void row(const Name& name, char sense, long double rhs) {}
+    void column(const Name& name, bool integer) {
+        bool one;
+        if (name.prefix[0] == 'y')
+            one = assignment[name.ids[0]] == name.ids[1];
+        else if (name.prefix[0] == 'z')
+            one = address[address.size() / 2 + name.ids[0]] == name.ids[1];
+        else
+            one = address[name.ids[0]] == name.ids[1];
+        name.write(out);
+        out.put(one ? " 1\n" : " 0\n");
+    }
+    void term(const Name& name, long double coefficient) {}
+    void end() {}
+};
+
+// Write the columns of the formulation of writeMILP selected by a full assignment
+void MN::writeMIPStart(MN& mn_c, bool compact, const vector<int>& assignment, const string& filename) {
+    StreamWriter out(filename);
+    StartVisitor visitor(out);
+    set_assignment(assignment);
+    int n = potentials.size();
+    visitor.assignment = vector<int>(assignment.size());
+    for (int v = 0; v < assignment.size(); v++)
+        visitor.assignment[original_variable(v)] = assignment[v];
+    visitor.address = vector<long long>(2 * n);
+    for (int i = 0; i < n; i++) {
+        visitor.address[original_potential(i)] = Variable::getAddress(potentials[i]->variables);
+        visitor.address[n + original_potential(i)] = Variable::getAddress(mn_c.potentials[i]->variables);
+    }
+    out.put("# MIP start from CMPE: objective ");
+    out.put(-mn_c.getValue());
+    out.put('\n');
+    if (compact) {
+        CompactFormulation formulation(*this, mn_c, 0);
+        formulation.columns(visitor);
+    } else {
+        PairwiseFormulation formulation(*this, mn_c, 0);
+        formulation.columns(visitor);
+    }
+}
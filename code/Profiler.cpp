@@ -0,0 +1,342 @@
+/*
+ * Profiler.cpp
+ *
+ *
+ *      Authors: Sara Rouhani,Tahrima Rahman,Vibhav Gogate. The University of Texas at Dallas
+ *      Contacts: {sara.rouhani,tahrima.rahman,vibhav.gogate}@utdallas.edu
+ *
+ *      MIT License
+ *
+ *      Permission is hereby granted, free of charge, to any person obtaining a copy
+ *      of this software and associated documentation files (the "Software"), to deal
+ *      in the Software without restriction, including without limitation the rights
+ *      to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *      copies of the Software, and to permit persons to whom the Software is
+ *      furnished to do so, subject to the following conditions:
+ *
+ *      The above copyright notice and this permission notice shall be included in all
+ *      copies or substantial portions of the Software.
+ *
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *      AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *      LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *      OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *      SOFTWARE.
+ */
+
+#ifdef USE_PROFILER
+
+#include <vector>
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "Profiler.h"
+
+static const int HARDWARE_COUNTERS = 4;
+static const char* hardware_names[HARDWARE_COUNTERS] = {"cycles", "instructions", "cache-misses", "branch-misses"};
+static const char* counter_names[PROFILE_COUNTERS] = {"Iterations", "Moves", "MCKP calls",
+                                                      "MCKP items after dominance", "Table entries built"};
+// Scopes of a thread written to the trace; later scopes are only added to the summary
+static const size_t MAX_TRACE_EVENTS = 1 << 20;
+
+struct PhaseTotals {
+    long long calls;
+    double seconds;
+    long long hardware[HARDWARE_COUNTERS];
+};
+
+// A finished scope, in microseconds since Profiler::start
+struct TraceEvent {
+    const char* phase;
+    double start;
+    double duration;
+};
+
+struct OpenScope {
+    const char* phase;
+    std::chrono::steady_clock::time_point start;
+    long long hardware[HARDWARE_COUNTERS];
+};
+
+/*
+ * Profile of one thread, only written by that thread. When the thread exits its counters are
+ * closed and the profile is reused by the next new thread, as the same row of the trace
+ * perf_fds: its group of hardware counters, the leader first; empty without hardware counters
+ * phases:   totals by phase name; names are string literals, merged by value in report
+ */
+struct ThreadProfile {
+    int id;
+    vector<int> perf_fds;
+    vector<OpenScope> stack;
+    vector<TraceEvent> events;
+    long long dropped_events;
+    map<const char*, PhaseTotals> phases;
+    long long counters[PROFILE_COUNTERS];
+    ThreadProfile() : id(0), dropped_events(0) {
+        std::fill(counters, counters + PROFILE_COUNTERS, 0);
+    }
+    int perf_fd() const { return perf_fds.empty() ? -1 : perf_fds[0]; }
+};
+
+bool Profiler::enabled = false;
+static string trace_file;
+static bool hardware = false;
+static std::chrono::steady_clock::time_point origin;
+static std::mutex profiles_mutex;
+static vector<ThreadProfile*> profiles;
+// Profiles of exited threads, free for new threads
+static vector<ThreadProfile*> free_profiles;
+
+static void close_hardware_counters(vector<int>& fds);
+
+// Profile of the calling thread, released when the thread exits
+struct ThreadProfileHandle {
+    ThreadProfile* profile;
+    ThreadProfileHandle() : profile(nullptr) {}
+    ~ThreadProfileHandle() {
+        if (profile == nullptr)
+            return;
+        close_hardware_counters(profile->perf_fds);
+        profile->stack.clear();
+        std::lock_guard<std::mutex> lock(profiles_mutex);
+        free_profiles.push_back(profile);
+    }
+};
+static thread_local ThreadProfileHandle thread_profile;
+
+#ifdef __linux__
+// Opens the hardware counters of the calling thread as one group, read at once through
+// fds[0]; fds is left empty on failure
+static void open_hardware_counters(vector<int>& fds)
+{
+    static const unsigned long long configs[HARDWARE_COUNTERS] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                                  PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+    for (int c = 0; c < HARDWARE_COUNTERS; c++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[c];
+        attr.disabled = c == 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        int fd = syscall(__NR_perf_event_open, &attr, 0, -1, fds.empty() ? -1 : fds[0], 0);
+        if (fd < 0) {
+            int error = errno;
+            close_hardware_counters(fds);
+            errno = error;
+            return;
+        }
+        fds.push_back(fd);
+    }
+    ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+static void close_hardware_counters(vector<int>& fds)
+{
+    for (auto fd : fds)
+        close(fd);
+    fds.clear();
+}
+
+static void read_hardware_counters(int fd, long long* values)
+{
+    unsigned long long buffer[1 + HARDWARE_COUNTERS];
+    if (fd < 0 || read(fd, buffer, sizeof(buffer)) != sizeof(buffer)) {
+        std::fill(values, values + HARDWARE_COUNTERS, 0);
+        return;
+    }
+    // buffer[0] is the number of counters of the group
+    for (int c = 0; c < HARDWARE_COUNTERS; c++)
+        values[c] = buffer[1 + c];
+}
+#else
+static void open_hardware_counters(vector<int>& fds)
+{
+    errno = ENOSYS;
+}
+
+static void close_hardware_counters(vector<int>& fds)
+{
+}
+
+static void read_hardware_counters(int fd, long long* values)
+{
+    std::fill(values, values + HARDWARE_COUNTERS, 0);
+}
+#endif
+
+static ThreadProfile* get_thread_profile()
+{
+    if (thread_profile.profile == nullptr) {
+        {
+            std::lock_guard<std::mutex> lock(profiles_mutex);
+            if (free_profiles.empty()) {
+                thread_profile.profile = new ThreadProfile();
+                thread_profile.profile->id = profiles.size();
+                profiles.push_back(thread_profile.profile);
+            } else {
+                thread_profile.profile = free_profiles.back();
+                free_profiles.pop_back();
+            }
+        }
+        if (hardware)
+            open_hardware_counters(thread_profile.profile->perf_fds);
+    }
+    return thread_profile.profile;
+}
+
+void Profiler::start(const string& trace_filename, bool hardware_counters)
+{
+    trace_file = trace_filename;
+    origin = std::chrono::steady_clock::now();
+    // The calling thread is thread 0 of the trace
+    ThreadProfile* profile = get_thread_profile();
+    if (hardware_counters) {
+        // The counters of the calling thread tell whether those of the other threads can be opened
+        open_hardware_counters(profile->perf_fds);
+        if (profile->perf_fds.empty())
+            cerr << "Hardware counters unavailable (perf_event_open: " << strerror(errno) << ")\n";
+        hardware = !profile->perf_fds.empty();
+    }
+    enabled = true;
+}
+
+void Profiler::begin(const char* phase)
+{
+    ThreadProfile* profile = get_thread_profile();
+    OpenScope scope;
+    scope.phase = phase;
+    read_hardware_counters(profile->perf_fd(), scope.hardware);
+    scope.start = std::chrono::steady_clock::now();
+    profile->stack.push_back(scope);
+}
+
+void Profiler::end()
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    ThreadProfile* profile = get_thread_profile();
+    long long hardware_now[HARDWARE_COUNTERS];
+    read_hardware_counters(profile->perf_fd(), hardware_now);
+    OpenScope& scope = profile->stack.back();
+    double seconds = std::chrono::duration<double>(now - scope.start).count();
+    PhaseTotals& totals = profile->phases[scope.phase];
+    totals.calls++;
+    totals.seconds += seconds;
+    for (int c = 0; c < HARDWARE_COUNTERS; c++)
+        totals.hardware[c] += hardware_now[c] - scope.hardware[c];
+    if (profile->events.size() < MAX_TRACE_EVENTS) {
+        TraceEvent event = {scope.phase, std::chrono::duration<double, std::micro>(scope.start - origin).count(), seconds * 1e6};
+        profile->events.push_back(event);
+    } else {
+        profile->dropped_events++;
+    }
+    profile->stack.pop_back();
+}
+
+void Profiler::count(ProfileCounter counter, long long n)
+{
+    get_thread_profile()->counters[counter] += n;
+}
+
+// Summary of the phases of every thread, by decreasing time, and Chrome trace of the scopes
+void Profiler::report(ostream& out)
+{
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - origin).count();
+    std::lock_guard<std::mutex> lock(profiles_mutex);
+    map<string, PhaseTotals> phases;
+    long long counters[PROFILE_COUNTERS] = {0};
+    long long dropped_events = 0;
+    for (auto profile : profiles) {
+        for (auto& phase : profile->phases) {
+            PhaseTotals& totals = phases[phase.first];
+            totals.calls += phase.second.calls;
+            totals.seconds += phase.second.seconds;
+            for (int c = 0; c < HARDWARE_COUNTERS; c++)
+                totals.hardware[c] += phase.second.hardware[c];
+        }
+        for (int c = 0; c < PROFILE_COUNTERS; c++)
+            counters[c] += profile->counters[c];
+        dropped_events += profile->dropped_events;
+    }
+    vector<pair<string, PhaseTotals> > sorted(phases.begin(), phases.end());
+    std::sort(sorted.begin(), sorted.end(), [](const pair<string, PhaseTotals>& lhs, const pair<string, PhaseTotals>& rhs) {
+        return lhs.second.seconds > rhs.second.seconds;
+    });
+    std::ios_base::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << "Profile (wall time = " << std::fixed << std::setprecision(3) << wall << " s, threads = " << profiles.size() << "):" << endl;
+    out << std::left << std::setw(26) << "phase" << std::right << std::setw(12) << "calls" << std::setw(12) << "total s"
+        << std::setw(12) << "mean us" << std::setw(9) << "% wall";
+    if (hardware) {
+        for (int c = 0; c < HARDWARE_COUNTERS; c++)
+            out << std::setw(16) << hardware_names[c];
+        out << std::setw(8) << "IPC";
+    }
+    out << endl;
+    for (auto& phase : sorted) {
+        const PhaseTotals& totals = phase.second;
+        out << std::left << std::setw(26) << phase.first << std::right << std::setw(12) << totals.calls
+            << std::setw(12) << std::setprecision(3) << totals.seconds
+            << std::setw(12) << std::setprecision(2) << totals.seconds * 1e6 / totals.calls
+            << std::setw(9) << std::setprecision(1) << (wall > 0 ? 100.0 * totals.seconds / wall : 0.0);
+        if (hardware) {
+            for (int c = 0; c < HARDWARE_COUNTERS; c++)
+                out << std::setw(16) << totals.hardware[c];
+            out << std::setw(8) << std::setprecision(2)
+                << (totals.hardware[0] > 0 ? (double) totals.hardware[1] / totals.hardware[0] : 0.0);
+        }
+        out << endl;
+    }
+    for (int c = 0; c < PROFILE_COUNTERS; c++) {
+        out << counter_names[c] << " = " << counters[c] << " (" << std::setprecision(1)
+            << (wall > 0 ? counters[c] / wall : 0.0) << "/s)" << endl;
+    }
+    if (counters[PROFILE_MCKP_CALLS] > 0) {
+        out << "Items per MCKP = " << std::setprecision(1)
+            << (double) counters[PROFILE_MCKP_ITEMS] / counters[PROFILE_MCKP_CALLS] << endl;
+    }
+    out.flags(flags);
+    out.precision(precision);
+    if (dropped_events > 0)
+        out << "Scopes not traced = " << dropped_events << " (first " << MAX_TRACE_EVENTS << " of each thread traced)" << endl;
+    if (trace_file.empty())
+        return;
+    ofstream trace(trace_file, ofstream::out);
+    if (!trace.good()) {
+        cerr << "Cannot write the trace file " << trace_file << "\n";
+        return;
+    }
+    trace << std::fixed << std::setprecision(3) << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    for (auto profile : profiles) {
+        trace << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << profile->id
+              << ",\"args\":{\"name\":\"" << (profile->id == 0 ? string("main") : "worker " + to_string(profile->id)) << "\"}}";
+        first = false;
+        for (auto& event : profile->events) {
+            trace << ",\n{\"name\":\"" << event.phase << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << profile->id
+                  << ",\"ts\":" << event.start << ",\"dur\":" << event.duration << "}";
+        }
+    }
+    trace << "\n]}\n";
+    trace.close();
+    out << "Trace written to " << trace_file << endl;
+}
+
+#endif
@@ -0,0 +1,84 @@
+/*
+ * Profiler.h
+ *
+ *
+ *      Authors: Sara Rouhani,Tahrima Rahman,Vibhav Gogate. The University of Texas at Dallas
+ *      Contacts: {sara.rouhani,tahrima.rahman,vibhav.gogate}@utdallas.edu
+ *
+ *      MIT License
+ *
+ *      Permission is hereby granted, free of charge, to any person obtaining a copy
+ *      of this software and associated documentation files (the "Software"), to deal
+ *      in the Software without restriction, including without limitation the rights
+ *      to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *      copies of the Software, and to permit persons to whom the Software is
+ *      furnished to do so, subject to the following conditions:
+ *
+ *      The above copyright notice and this permission notice shall be included in all
+ *      copies or substantial portions of the Software.
+ *
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *      AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *      LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *      OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *      SOFTWARE.
+ */
+
+#ifndef CMPE_PROFILER_H
+#define CMPE_PROFILER_H
+
+#include <string>
+#include <iostream>
+using namespace std;
+
+/*
+ * Phase profiler, compiled in with -DUSE_PROFILER (cmake -DWITH_PROFILER=ON); without it
+ * PROFILE_SCOPE and PROFILE_COUNT expand to nothing.
+ * PROFILE_SCOPE(phase) times the rest of the enclosing block under the name phase and
+ * PROFILE_COUNT(counter, n) adds n to a counter. Nothing is recorded until Profiler::start;
+ * every thread then keeps its own scopes. report prints the calls and time of every phase,
+ * nested phases included, and the counters, and writes the scopes as a Chrome trace
+ * (chrome://tracing or Perfetto). With hardware counters, the cycles, instructions, cache
+ * misses and branch misses of the thread are read by perf_event_open around every scope
+ */
+enum ProfileCounter {
+    PROFILE_ITERATIONS,     // steps of the local search
+    PROFILE_MOVES,          // changes of the cut assignment: accepted moves and random escapes
+    PROFILE_MCKP_CALLS,     // calls of greedy_solve_MCKP
+    PROFILE_MCKP_ITEMS,     // items left in the bins after removing dominated items
+    PROFILE_TABLE_ENTRIES,  // entries of the component tables built
+    PROFILE_COUNTERS
+};
+
+#ifdef USE_PROFILER
+
+struct Profiler {
+    static bool enabled;
+    static void start(const string& trace_filename, bool hardware_counters);
+    static void begin(const char* phase);
+    static void end();
+    static void count(ProfileCounter counter, long long n);
+    static void report(ostream& out);
+};
+
+struct ProfileScope {
+    bool active;
+    ProfileScope(const char* phase) : active(Profiler::enabled) { if (active) Profiler::begin(phase); }
+    ~ProfileScope() { if (active) Profiler::end(); }
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(phase) ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(phase)
+#define PROFILE_COUNT(counter, n) do { if (Profiler::enabled) Profiler::count(counter, n); } while (0)
+
+#else
+
+#define PROFILE_SCOPE(phase)
+#define PROFILE_COUNT(counter, n)
+
+#endif
+
+#endif //CMPE_PROFILER_H
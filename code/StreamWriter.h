@@ -0,0 +1,103 @@
+/*
+ * StreamWriter.h
+ *
+ *
+ *      Authors: Sara Rouhani,Tahrima Rahman,Vibhav Gogate. The University of Texas at Dallas
+ *      Contacts: {sara.rouhani,tahrima.rahman,vibhav.gogate}@utdallas.edu
+ *
+ *      MIT License
+ *
+ *      Permission is hereby granted, free of charge, to any person obtaining a copy
+ *      of this software and associated documentation files (the "Software"), to deal
+ *      in the Software without restriction, including without limitation the rights
+ *      to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *      copies of the Software, and to permit persons to whom the Software is
+ *      furnished to do so, subject to the following conditions:
+ *
+ *      The above copyright notice and this permission notice shall be included in all
+ *      copies or substantial portions of the Software.
+ *
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *      AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *      LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *      OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *      SOFTWARE.
+ */
+
+#ifndef CMPE_STREAMWRITER_H
+#define CMPE_STREAMWRITER_H
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+/*
+ * Buffered output to a file descriptor; files are written as they are enumerated so memory
+ * does not grow with the size of the file
+ */
+struct StreamWriter {
+    int fd;
+    vector<char> buffer;
+    size_t used;
+    StreamWriter(const string& filename) : buffer(1 << 20), used(0) {
+        fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            cerr << "Could not open " << filename << " for writing\n";
+            exit(-1);
+        }
+    }
+    ~StreamWriter() {
+        flush();
+        close(fd);
+    }
+    void flush() {
+        size_t written = 0;
+        while (written < used) {
+            ssize_t n = ::write(fd, buffer.data() + written, used - written);
+            if (n < 0) {
+                cerr << "Write error\n";
+                exit(-1);
+            }
+            written += n;
+        }
+        used = 0;
+    }
+    void reserve(size_t n) {
+        if (used + n > buffer.size())
+            flush();
+    }
+    void put(char c) {
+        reserve(1);
+        buffer[used++] = c;
+    }
+    void put(const char* s) {
+        size_t n = strlen(s);
+        reserve(n);
+        memcpy(buffer.data() + used, s, n);
+        used += n;
+    }
+    void put(long long n) {
+        reserve(24);
+        used += snprintf(buffer.data() + used, 24, "%lld", n);
+    }
+    void put(long double x) {
+        reserve(32);
+        used += snprintf(buffer.data() + used, 32, "%.17g", (double) x);
+    }
+    // x with the given number of significant digits
+    void put(double x, int digits) {
+        reserve(32);
+        used += snprintf(buffer.data() + used, 32, "%.*g", digits, x);
+    }
+};
+
+#endif //CMPE_STREAMWRITER_H
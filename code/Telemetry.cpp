@@ -0,0 +1,138 @@
+/*
+ * Telemetry.cpp
+ *
+ *
+ *      Authors: Sara Rouhani,Tahrima Rahman,Vibhav Gogate. The University of Texas at Dallas
+ *      Contacts: {sara.rouhani,tahrima.rahman,vibhav.gogate}@utdallas.edu
+ *
+ *      MIT License
+ *
+ *      Permission is hereby granted, free of charge, to any person obtaining a copy
+ *      of this software and associated documentation files (the "Software"), to deal
+ *      in the Software without restriction, including without limitation the rights
+ *      to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *      copies of the Software, and to permit persons to whom the Software is
+ *      furnished to do so, subject to the following conditions:
+ *
+ *      The above copyright notice and this permission notice shall be included in all
+ *      copies or substantial portions of the Software.
+ *
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *      AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *      LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *      OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *      SOFTWARE.
+ */
+
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+#include <limits>
+#include <cmath>
+#include <cstdlib>
+
+#include "Telemetry.h"
+
+struct TelemetryRecord {
+    string fields;
+    vector<int> assignment;
+};
+
+bool Telemetry::enabled = false;
+double Telemetry::interval = 1.0;
+static std::chrono::steady_clock::time_point origin;
+static ofstream stream;
+static std::mutex queue_mutex;
+static std::condition_variable queue_ready;
+static deque<TelemetryRecord> queue;
+static bool stopping = false;
+static std::thread writer;
+
+// Writes the records queued so far in one batch, flushed so that the file can be followed live
+static void write_records()
+{
+    while (true) {
+        deque<TelemetryRecord> records;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            queue_ready.wait(lock, [] { return !queue.empty() || stopping; });
+            if (queue.empty())
+                return;
+            records.swap(queue);
+        }
+        for (auto& record : records) {
+            stream << "{" << record.fields;
+            if (!record.assignment.empty()) {
+                stream << ",\"assignment\":[";
+                for (int v = 0; v < record.assignment.size(); v++)
+                    stream << (v == 0 ? "" : ",") << record.assignment[v];
+                stream << "]";
+            }
+            stream << "}\n";
+        }
+        stream.flush();
+    }
+}
+
+void Telemetry::start(const string& filename, double interval_)
+{
+    stream.open(filename, ofstream::out);
+    if (!stream.good()) {
+        cerr << "Cannot write the telemetry file " << filename << "\n";
+        exit(-1);
+    }
+    origin = std::chrono::steady_clock::now();
+    interval = interval_;
+    enabled = true;
+    writer = std::thread(write_records);
+    // An exit after an error must join the writer before it is destroyed, or the program aborts
+    atexit(Telemetry::stop);
+}
+
+double Telemetry::now()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - origin).count();
+}
+
+void Telemetry::write(const string& fields, vector<int>&& assignment)
+{
+    TelemetryRecord record;
+    record.fields = fields;
+    record.assignment = std::move(assignment);
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        queue.push_back(std::move(record));
+    }
+    queue_ready.notify_one();
+}
+
+void Telemetry::stop()
+{
+    if (!enabled)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        stopping = true;
+    }
+    queue_ready.notify_one();
+    writer.join();
+    stream.close();
+    enabled = false;
+}
+
+string Telemetry::number(long double value)
+{
+    if (std::isinf(value) || std::isnan(value) || fabsl(value) == std::numeric_limits<long double>::max())
+        return "null";
+    ostringstream out;
+    out.precision(17);
+    out << value;
+    return out.str();
+}
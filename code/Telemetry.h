@@ -0,0 +1,56 @@
+/*
+ * Telemetry.h
+ *
+ *
+ *      Authors: Sara Rouhani,Tahrima Rahman,Vibhav Gogate. The University of Texas at Dallas
+ *      Contacts: {sara.rouhani,tahrima.rahman,vibhav.gogate}@utdallas.edu
+ *
+ *      MIT License
+ *
+ *      Permission is hereby granted, free of charge, to any person obtaining a copy
+ *      of this software and associated documentation files (the "Software"), to deal
+ *      in the Software without restriction, including without limitation the rights
+ *      to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *      copies of the Software, and to permit persons to whom the Software is
+ *      furnished to do so, subject to the following conditions:
+ *
+ *      The above copyright notice and this permission notice shall be included in all
+ *      copies or substantial portions of the Software.
+ *
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *      AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *      LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *      OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *      SOFTWARE.
+ */
+
+#ifndef CMPE_TELEMETRY_H
+#define CMPE_TELEMETRY_H
+
+#include <string>
+#include <vector>
+using namespace std;
+
+/*
+ * JSON-lines telemetry stream of the search: one JSON object per line. The search only
+ * queues records; a background thread formats the assignments and writes the file, so that
+ * file I/O never stalls the search. Times are steady_clock seconds since start.
+ * interval:  seconds between two status records of a search, may be below one second
+ */
+struct Telemetry {
+    static bool enabled;
+    static double interval;
+    static void start(const string& filename, double interval_);
+    static double now();
+    // Queues the record {fields,"assignment":[assignment]}; fields are "name":value pairs
+    static void write(const string& fields, vector<int>&& assignment);
+    static void write(const string& fields) { write(fields, vector<int>()); }
+    // Writes the queued records and stops the writer thread
+    static void stop();
+    // value as a JSON number, null if it is infinite or +-max (no solution)
+    static string number(long double value);
+};
+
+#endif //CMPE_TELEMETRY_H
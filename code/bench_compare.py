@@ -0,0 +1,47 @@
+#!/usr/bin/env python3
+# Compares two JSON result files of cmpe_bench (or Google Benchmark):
+#   python3 bench_compare.py <baseline.json> <contender.json> [threshold]
+# prints the time per operation of every benchmark in both files and the relative change, and
+# exits with status 1 if a benchmark is slower than the baseline by more than threshold
+# (a fraction, default 0.10)
+import json
+import sys
+
+
+def read_results(filename):
+    with open(filename) as f:
+        benchmarks = json.load(f)["benchmarks"]
+    # Google Benchmark also lists the aggregates of repetitions; keep the plain runs
+    return {b["name"]: b["real_time"] for b in benchmarks if b.get("run_type", "iteration") == "iteration"}
+
+
+def main():
+    if len(sys.argv) < 3:
+        sys.stderr.write("Usage: %s <baseline.json> <contender.json> [threshold]\n" % sys.argv[0])
+        sys.exit(2)
+    baseline = read_results(sys.argv[1])
+    contender = read_results(sys.argv[2])
+    threshold = float(sys.argv[3]) if len(sys.argv) > 3 else 0.10
+    regressions = 0
+    print("%-44s %16s %16s %9s" % ("benchmark", "baseline ns", "contender ns", "change"))
+    for name in list(baseline) + [name for name in contender if name not in baseline]:
+        if name not in baseline or name not in contender:
+            old = "%16.1f" % baseline[name] if name in baseline else "%16s" % "-"
+            new = "%16.1f" % contender[name] if name in contender else "%16s" % "-"
+            print("%-44s %s %s %9s" % (name, old, new, "-"))
+            continue
+        change = contender[name] / baseline[name] - 1 if baseline[name] > 0 else 0.0
+        flag = ""
+        if change > threshold:
+            flag = "  slower"
+            regressions += 1
+        elif change < -threshold:
+            flag = "  faster"
+        print("%-44s %16.1f %16.1f %+8.1f%%%s" % (name, baseline[name], contender[name], 100 * change, flag))
+    if regressions > 0:
+        print("%d benchmark(s) slower by more than %.0f%%" % (regressions, 100 * threshold))
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -30,30 +30,118 @@
 #include <fstream>
 #include <cstring>
 #include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
 
 #include "MN.h"
+#include "Profiler.h"
+#include "Telemetry.h"
 
 using namespace std;
 
 void print_help(const string &program_name) {
     cerr << "Usage: " << program_name << " -m1 <uaifilename1> -m2 <uaifilename2> -o <outfilename> -q <q-value>\n";
-    cerr << "\t Other Options: [-t -k -s -si ]\n";
+    cerr << "\t Other Options: [-t -k -s -si -tabu -asp -cache -lns -sched -warm -bb -bbn -gap -lag -pbe -eps -pf -beam -screen -batch -a -e -presolve -reorder -prof -hwc -tel -ti ]\n";
     cerr << "-------------------------------------------------------------------------\n";
     cerr << "\t\t Details on Required Option\n";
     cerr << "\t\t\t uaifilename1 and uaifilename2: are evidence instantiated Markov networks in UAI format\n";
     cerr << "\t\t\t outfilename: Results of experiments will be stored here\n";
     cerr << "\t\t\t q-value: (Real number): constraint on weight of the assignment in CMPE\n";
+    cerr << "\t\t\t          or a comma separated list of q values, or a file with one q value per line\n";
     cerr << "-------------------------------------------------------------------------\n";
     cerr << "\t\t Details on Other Options and Default values\n";
     cerr << "\t\t\t -t     [int]: max time for which each k is run; default 2\n";
     cerr << "\t\t\t -k     [int]: max k-seperator size. The code iterates from 1 to k in increments of 2\n";
     cerr << "\t\t\t -s     [int]: Seed for Repeatability; default 1000000L\n";
     cerr << "\t\t\t -si    [int]: print status every integer seconds; default 1\n";
+    cerr << "\t\t\t -tabu  [int]: tabu tenure for moves on cut variables; default 0 (random escape)\n";
+    cerr << "\t\t\t -asp   [int]: 1 allows tabu moves that improve the best solution; default 1\n";
+    cerr << "\t\t\t -cache [int]: slots in the cache of evaluated cut assignments; default 0 (off)\n";
+    cerr << "\t\t\t -lns   [int]: max cut variables re-optimized jointly at local maxima; default 0 (off)\n";
+    cerr << "\t\t\t -sched [int]: 0 runs each k for max time; 1 shares the total time by successive halving; default 0\n";
+    cerr << "\t\t\t -warm  [int]: 1 starts each k from the best assignment found so far; default 0\n";
+    cerr << "\t\t\t -bb    [int]: seconds of branch and bound after the search (largest k); default 0 (off)\n";
+    cerr << "\t\t\t -bbn   [int]: max nodes of branch and bound; default 0 (no limit)\n";
+    cerr << "\t\t\t -gap  [real]: stop once (upper bound - best)/|best| is at most this value; default 0\n";
+    cerr << "\t\t\t -lag   [int]: i-bound of the Lagrangian dual bound computed before the search; default 0 (off)\n";
+    cerr << "\t\t\t -pbe   [int]: solve by Pareto bucket elimination if the induced width is at most this value; default 0 (off)\n";
+    cerr << "\t\t\t -eps  [real]: values of Pareto bucket elimination are within a factor 1+eps of optimal; default 0 (exact)\n";
+    cerr << "\t\t\t -pf [string]: write the (logq, best) frontier of Pareto bucket elimination to this file\n";
+    cerr << "\t\t\t -beam  [int]: max items of each component bin, built by Pareto beam search; default 0 (full joint tables)\n";
+    cerr << "\t\t\t -screen [int]: 1 skips the MCKP of cut assignments that bounds show infeasible or dominated; default 0\n";
+    cerr << "\t\t\t -batch [int]: candidate cut assignments evaluated concurrently per step; default 0 (only the accepted move)\n";
+    cerr << "\t\t\t -e  [string]: UAI evidence file; both networks are conditioned on it when they are read\n";
+    cerr << "\t\t\t -presolve [int]: 1 adds potentials to potentials over a superset of their scope and folds constant ones; default 0\n";
+    cerr << "\t\t\t -reorder [int]: 1 renumbers variables by reverse Cuthill-McKee and sorts potentials to match; default 0\n";
+    cerr << "\t\t\t -a  [string]: write the best assignment (one line per q) to this file, e.g. for generate_mps -start\n";
+    cerr << "\t\t\t -prof [string]: print the time of every phase and write a Chrome trace to this file (needs -DUSE_PROFILER)\n";
+    cerr << "\t\t\t -hwc   [int]: 1 adds the hardware counters of every phase to the profile (Linux perf_event_open); default 0\n";
+    cerr << "\t\t\t -tel [string]: write a JSON-lines telemetry stream (status and every new incumbent) to this file\n";
+    cerr << "\t\t\t -ti   [real]: seconds between two status records of the telemetry, may be below 1; default 1\n";
     //cerr << "\t\t\t -w  [string]: Write file in MPS format and store it in string\n";
 }
 
 
+// Reads a q value, a comma separated list of q values or a file with one q value per line
+void read_q_values(const string &argument, vector<long double> &qs) {
+    ifstream infile(argument);
+    if (infile.good()) {
+        long double q;
+        while (infile >> q)
+            qs.push_back(q);
+    } else {
+        stringstream list(argument);
+        string token;
+        while (getline(list, token, ','))
+            qs.push_back(atof(token.c_str()));
+    }
+    if (qs.empty()) {
+        cerr << "No q value in " << argument << "\n";
+        exit(-1);
+    }
+}
+
+// Writes one assignment per line as in the UAI MPE format: the number of variables followed
+// by their values, evidence included. Empty assignments (no solution found) are skipped
+void write_assignments(const string &filename, const vector<vector<int> > &assignments, MN &mn) {
+    if (filename.empty())
+        return;
+    ofstream out(filename, ofstream::out);
+    for (auto& assignment : assignments) {
+        if (assignment.empty())
+            continue;
+        vector<int> uai_assignment;
+        mn.expand_assignment(assignment, uai_assignment);
+        out << uai_assignment.size();
+        for (auto value : uai_assignment)
+            out << " " << value;
+        out << "\n";
+    }
+    out.close();
+}
+
+// Prints the profile and writes its trace, if the profiler was started, and writes the rest
+// of the telemetry stream
+void finish_reports() {
+#ifdef USE_PROFILER
+    if (Profiler::enabled)
+        Profiler::report(cout);
+#endif
+    Telemetry::stop();
+}
+
 int GlobalSearchOptions::print_interval = 1; //print stat every 100 seconds
+int GlobalSearchOptions::tabu_tenure = 0;
+bool GlobalSearchOptions::tabu_aspiration = true;
+int GlobalSearchOptions::cache_size = 0;
+int GlobalSearchOptions::lns_size = 0;
+int GlobalSearchOptions::schedule = 0;
+bool GlobalSearchOptions::warm_start = false;
+long double GlobalSearchOptions::gap = 0.0;
+int GlobalSearchOptions::beam_size = 0;
+bool GlobalSearchOptions::screen = false;
+int GlobalSearchOptions::batch_size = 0;
 
 /*
  * This program can be run in two modes
@@ -68,7 +156,21 @@ int main(int argc, char *argv[]) {
     int max_time = 1200;
     int k = 15;
     int sampling_number = 1000;
-    long double q;
+    int bb_time = 0;
+    int lag_ibound = 0;
+    int pareto_width = 0;
+    long double epsilon = 0.0;
+    string frontier_filename;
+    string assignment_filename;
+    string evidence_filename;
+    string profile_filename;
+    string telemetry_filename;
+    double telemetry_interval = 1.0;
+    bool hardware_counters = false;
+    bool presolve = false;
+    bool reorder = false;
+    long long bb_nodes = 0;
+    vector<long double> qs;
     bool uaioption1 = false, uaioption2 = false, outoption = false, qoption = false;
     if (argc == 1) {
         print_help(argv[0]);
@@ -93,8 +195,56 @@ int main(int argc, char *argv[]) {
             srand(seed);
         } else if (strcmp(argv[i], "-si") == 0) {
             GlobalSearchOptions::print_interval = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-tabu") == 0) {
+            GlobalSearchOptions::tabu_tenure = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-asp") == 0) {
+            GlobalSearchOptions::tabu_aspiration = atoi(argv[i + 1]) != 0;
+        } else if (strcmp(argv[i], "-cache") == 0) {
+            GlobalSearchOptions::cache_size = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-lns") == 0) {
+            GlobalSearchOptions::lns_size = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-sched") == 0) {
+            GlobalSearchOptions::schedule = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-warm") == 0) {
+            GlobalSearchOptions::warm_start = atoi(argv[i + 1]) != 0;
+        } else if (strcmp(argv[i], "-bb") == 0) {
+            bb_time = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-bbn") == 0) {
+            bb_nodes = atoll(argv[i + 1]);
+        } else if (strcmp(argv[i], "-gap") == 0) {
+            GlobalSearchOptions::gap = atof(argv[i + 1]);
+        } else if (strcmp(argv[i], "-lag") == 0) {
+            lag_ibound = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-pbe") == 0) {
+            pareto_width = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-eps") == 0) {
+            epsilon = atof(argv[i + 1]);
+        } else if (strcmp(argv[i], "-pf") == 0) {
+            frontier_filename = argv[i + 1];
+        } else if (strcmp(argv[i], "-beam") == 0) {
+            GlobalSearchOptions::beam_size = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-screen") == 0) {
+            GlobalSearchOptions::screen = atoi(argv[i + 1]) != 0;
+        } else if (strcmp(argv[i], "-batch") == 0) {
+            GlobalSearchOptions::batch_size = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-presolve") == 0) {
+            presolve = atoi(argv[i + 1]) != 0;
+        } else if (strcmp(argv[i], "-reorder") == 0) {
+            reorder = atoi(argv[i + 1]) != 0;
+        } else if (strcmp(argv[i], "-e") == 0) {
+            evidence_filename = argv[i + 1];
+        } else if (strcmp(argv[i], "-a") == 0) {
+            assignment_filename = argv[i + 1];
+        } else if (strcmp(argv[i], "-prof") == 0) {
+            profile_filename = argv[i + 1];
+        } else if (strcmp(argv[i], "-hwc") == 0) {
+            hardware_counters = atoi(argv[i + 1]) != 0;
+        } else if (strcmp(argv[i], "-tel") == 0) {
+            telemetry_filename = argv[i + 1];
+        } else if (strcmp(argv[i], "-ti") == 0) {
+            telemetry_interval = atof(argv[i + 1]);
         } else if (strcmp(argv[i], "-q") == 0) {
-            q = atof(argv[i + 1]);
+            read_q_values(argv[i + 1], qs);
             qoption = true;
         } else if (strcmp(argv[i], "-h") == 0) {
             print_help(argv[0]);
@@ -121,16 +271,127 @@ int main(int argc, char *argv[]) {
         print_help(argv[0]);
         exit(-1);
     }
+    if (!profile_filename.empty() || hardware_counters) {
+#ifdef USE_PROFILER
+        Profiler::start(profile_filename, hardware_counters);
+#else
+        cerr << "CMPE was built without the profiler; compile with -DUSE_PROFILER\n";
+        exit(-1);
+#endif
+    }
+    if (!telemetry_filename.empty())
+        Telemetry::start(telemetry_filename, telemetry_interval);
     MN mn1, mn2;
-    mn1.readMN(uai_filename1);
+    mn1.readMN(uai_filename1, evidence_filename);
     mn2.readMN2(uai_filename2,mn1);
+    mn1.hard_constraints(mn2);
+    if (presolve)
+        mn1.presolve(mn2);
+    if (reorder)
+        mn1.reorder(mn2);
+    mn1.share_tables(mn2);
     if (mn1.variables.size() != mn2.variables.size()) {
         cerr << "Variable size mismatch\n";
         cerr << "Code requires the two Markov networks be defined over the same set of variables\n";
         exit(-1);
     }
+    long double q = qs[0];
     ofstream out(out_filename, ofstream::out);
-    mn1.run_experiments_neurips(mn2, q, k, out, max_time);
+    if (pareto_width > 0) {
+        ParetoResult pareto = mn1.pareto_elimination(mn2, qs, epsilon, pareto_width);
+        cout.precision(20);
+        cout << "Pareto bucket elimination:" << endl;
+        cout << "Induced width = " << pareto.induced_width << endl;
+        if (pareto.complete) {
+            cout << "Frontier size = " << pareto.frontier.size() << endl;
+            cout << "Max message frontier = " << pareto.max_frontier << endl;
+            cout << "Time = " << pareto.seconds << endl;
+            if (!frontier_filename.empty()) {
+                // Row i answers every q with frontier[i].weight <= logq < frontier[i+1].weight
+                ofstream frontier_out(frontier_filename, ofstream::out);
+                frontier_out.precision(20);
+                for (auto& point : pareto.frontier)
+                    frontier_out << point.first << "," << point.second << "\n";
+                frontier_out.close();
+            }
+            // The frontier answers every q at once
+            out.precision(20);
+            for (int j = 0; j < qs.size(); j++) {
+                if (qs.size() > 1)
+                    cout << "Q = " << qs[j] << endl;
+                if (!pareto.assignments[j].empty()) {
+                    out << qs[j] << ",0," << pareto.values[j] << "," << pareto.seconds << "\n";
+                    cout << "Best = " << pareto.values[j] << endl;
+                } else {
+                    cout << "Status = infeasible" << endl;
+                }
+            }
+            out.close();
+            write_assignments(assignment_filename, pareto.assignments, mn1);
+            finish_reports();
+            return 0;
+        }
+        cout << "Induced width above " << pareto_width << ", running the search" << endl;
+    }
+    if (qs.size() > 1) {
+        if (lag_ibound > 0 || bb_time > 0 || bb_nodes > 0)
+            cerr << "Lagrangian bound and branch and bound are ignored with several q values\n";
+        vector<long double> best_values;
+        vector<vector<int> > best_assignments;
+        mn1.run_sweep(mn2, qs, k, out, max_time, best_values, &best_assignments);
+        cout.precision(20);
+        cout << "Sweep:" << endl;
+        for (int j = 0; j < qs.size(); j++)
+            cout << "Q = " << qs[j] << ", best = " << best_values[j] << endl;
+        write_assignments(assignment_filename, best_assignments, mn1);
+        out.close();
+        finish_reports();
+        return 0;
+    }
+    long double upper_bound = std::numeric_limits<long double>::max();
+    LagrangianResult dual;
+    if (lag_ibound > 0) {
+        dual = mn1.lagrangian_bound(mn2, q, lag_ibound);
+        upper_bound = dual.bound;
+        cout.precision(20);
+        cout << "Lagrangian dual bound:" << endl;
+        cout << "Induced width = " << dual.induced_width << (dual.exact ? " (exact)" : " (mini-buckets)") << endl;
+        cout << "Lambda = " << dual.lambda << endl;
+        cout << "Upper bound = " << dual.bound << endl;
+        cout << "Best feasible maximizer = " << dual.primal << endl;
+        cout << "Time = " << dual.seconds << endl;
+        cerr << std::setprecision(20) << "Dual bound = " << dual.bound << "\n";
+    }
+    vector<int> best_assignment;
+    long double best = mn1.run_experiments_neurips(mn2, q, k, out, max_time, &best_assignment, upper_bound);
+    if (lag_ibound > 0 && dual.primal > best) {
+        best = dual.primal;
+        best_assignment = dual.assignment;
+    }
+    if (bb_time > 0 || bb_nodes > 0) {
+        // Prove the quality of the incumbent on the separator of the largest k
+        int bb_k = k % 2 == 1 ? k : k - 1;
+        BranchAndBoundResult result = mn1.branch_and_bound(mn2, q, bb_k, best, best_assignment, bb_time, bb_nodes);
+        cout.precision(20);
+        cout << "Branch and bound:" << endl;
+        cout << "K = " << bb_k << endl;
+        cout << "Nodes = " << result.nodes << endl;
+        cout << "Time = " << result.seconds << endl;
+        cout << "Lower bound = " << result.lower_bound << endl;
+        cout << "Upper bound = " << std::min(result.upper_bound, upper_bound) << endl;
+        if (result.lower_bound > best) {
+            best = result.lower_bound;
+            best_assignment = result.assignment;
+        }
+        if (result.lower_bound == -1 * std::numeric_limits<long double>::max()) {
+            cout << "Status = " << (result.complete ? "infeasible" : "no solution found") << endl;
+        } else {
+            cout << "Gap = " << (std::min(result.upper_bound, upper_bound) - result.lower_bound) / fabsl(result.lower_bound) << endl;
+            cout << "Status = " << (result.complete ? "optimal within gap" : "limit reached") << endl;
+        }
+    }
+    write_assignments(assignment_filename, vector<vector<int> >(1, best_assignment), mn1);
     out.close();
+    finish_reports();
     return 0;
 }
@@ -0,0 +1,489 @@
+/*
+ * main_bench.cpp
+ *
+ *
+ *      Authors: Sara Rouhani,Tahrima Rahman,Vibhav Gogate. The University of Texas at Dallas
+ *      Contacts: {sara.rouhani,tahrima.rahman,vibhav.gogate}@utdallas.edu
+ *
+ *      MIT License
+ *
+ *      Permission is hereby granted, free of charge, to any person obtaining a copy
+ *      of this software and associated documentation files (the "Software"), to deal
+ *      in the Software without restriction, including without limitation the rights
+ *      to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *      copies of the Software, and to permit persons to whom the Software is
+ *      furnished to do so, subject to the following conditions:
+ *
+ *      The above copyright notice and this permission notice shall be included in all
+ *      copies or substantial portions of the Software.
+ *
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *      AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *      LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *      OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *      SOFTWARE.
+ */
+
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cstdio>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <iomanip>
+
+#include "MN.h"
+
+using namespace std;
+
+extern long double
+greedy_solve_MCKP(vector<vector<long double> > &weights, vector<vector<long double> > &profits, long double max_cost,
+                  vector<long long> &solution, std::mt19937 *generator = nullptr);
+
+void print_help(const string &program_name) {
+    cerr << "Usage: " << program_name << " [-o <jsonfilename>]\n";
+    cerr << "\t Other Options: [-t -r -f -e2e -s ]\n";
+    cerr << "-------------------------------------------------------------------------\n";
+    cerr << "\t\t Details on Options and Default values\n";
+    cerr << "\t\t\t jsonfilename: results are written to this file in JSON format, for bench_compare.py\n";
+    cerr << "\t\t\t -t    [real]: min seconds of every repetition of a benchmark; default 0.2\n";
+    cerr << "\t\t\t -r     [int]: repetitions of every benchmark, the median time is reported; default 3\n";
+    cerr << "\t\t\t -f  [string]: run only the benchmarks whose name contains this string\n";
+    cerr << "\t\t\t -e2e  [real]: seconds of local search of every repetition of the end-to-end benchmarks; default 2\n";
+    cerr << "\t\t\t -s     [int]: seed of the synthetic networks and MCKPs; default 1\n";
+}
+
+int GlobalSearchOptions::print_interval = 1; //print stat every 100 seconds
+int GlobalSearchOptions::tabu_tenure = 0;
+bool GlobalSearchOptions::tabu_aspiration = true;
+int GlobalSearchOptions::cache_size = 0;
+int GlobalSearchOptions::lns_size = 0;
+int GlobalSearchOptions::schedule = 0;
+bool GlobalSearchOptions::warm_start = false;
+long double GlobalSearchOptions::gap = 0.0;
+int GlobalSearchOptions::beam_size = 0;
+bool GlobalSearchOptions::screen = false;
+int GlobalSearchOptions::batch_size = 0;
+
+/*
+ * Time per operation of one benchmark
+ * iterations: operations timed in the median repetition
+ * real_time:  median over the repetitions of the nanoseconds per operation
+ * items:      items processed per operation (variables read, entries built, ...), 0 if none
+ */
+struct BenchmarkResult {
+    string name;
+    long long iterations;
+    int repetitions;
+    double real_time;
+    double min_time;
+    double max_time;
+    double items;
+};
+
+static double min_seconds = 0.2;
+static int repetitions = 3;
+static string filter;
+static vector<BenchmarkResult> results;
+
+// Keeps the compiler from removing the computations whose result is otherwise unused
+static volatile long double sink;
+
+/*
+ * Runs body(n), which performs n operations, with n doubled until one call lasts min_seconds,
+ * then repeats it with that n and records the median time per operation
+ */
+template <class Body>
+static void run_benchmark(const string& name, double items, Body body)
+{
+    if (!filter.empty() && name.find(filter) == string::npos)
+        return;
+    long long n = 1;
+    double seconds = 0.0;
+    while (true) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        body(n);
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (seconds >= min_seconds || n >= (1LL << 40))
+            break;
+        // Aim directly at min_seconds once the time is measurable
+        n = seconds > 0.01 ? std::max(n + 1, (long long) (n * 1.2 * min_seconds / seconds)) : n * 10;
+    }
+    vector<double> times(1, seconds * 1e9 / n);
+    for (int r = 1; r < repetitions; r++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        body(n);
+        times.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1e9 / n);
+    }
+    std::sort(times.begin(), times.end());
+    BenchmarkResult result = {name, n, (int) times.size(), times[times.size() / 2], times.front(), times.back(), items};
+    results.push_back(result);
+    cout << std::left << std::setw(44) << name << std::right << std::setw(16) << std::fixed << std::setprecision(1)
+         << result.real_time << " ns" << std::setw(14) << n;
+    if (items > 0)
+        cout << std::setw(16) << std::setprecision(0) << items * 1e9 / result.real_time << " items/s";
+    cout << endl;
+}
+
+// Writes an n x n grid of variables with the given domain size, a unary potential on every
+// variable and a pairwise potential on every edge, with random entries in [0.1, 2). With shuffle
+// the variables are labelled and the potentials listed in random order. Returns the label of
+// the variable of every cell, row by row
+static vector<int> write_grid(const string& filename, int n, int domain_size, std::mt19937& generator, bool shuffle = false)
+{
+    std::uniform_real_distribution<double> entry(0.1, 2.0);
+    vector<int> label(n * n);
+    for (int v = 0; v < n * n; v++)
+        label[v] = v;
+    if (shuffle)
+        std::shuffle(label.begin(), label.end(), generator);
+    vector<vector<int> > scopes;
+    for (int v = 0; v < n * n; v++)
+        scopes.push_back(vector<int>(1, label[v]));
+    for (int r = 0; r < n; r++) {
+        for (int c = 0; c < n; c++) {
+            int v = r * n + c;
+            if (c + 1 < n)
+                scopes.push_back(vector<int>{label[v], label[v + 1]});
+            if (r + 1 < n)
+                scopes.push_back(vector<int>{label[v], label[v + n]});
+        }
+    }
+    if (shuffle)
+        std::shuffle(scopes.begin(), scopes.end(), generator);
+    ofstream out(filename, ofstream::out);
+    out << "MARKOV\n" << n * n << "\n";
+    for (int v = 0; v < n * n; v++)
+        out << domain_size << (v + 1 < n * n ? " " : "\n");
+    out << scopes.size() << "\n";
+    for (auto& scope : scopes) {
+        out << scope.size();
+        for (int v : scope)
+            out << " " << v;
+        out << "\n";
+    }
+    for (auto& scope : scopes) {
+        int size = scope.size() == 1 ? domain_size : domain_size * domain_size;
+        out << "\n" << size << "\n";
+        for (int e = 0; e < size; e++)
+            out << entry(generator) << (e + 1 < size ? " " : "\n");
+    }
+    out.close();
+    return label;
+}
+
+// Frees the potentials and variables read by readMN
+static void delete_network(MN& mn)
+{
+    for (auto potential : mn.potentials)
+        delete potential;
+    for (auto variable : mn.variables)
+        delete variable;
+}
+
+// Log-weight halfway between the smallest and the largest of the network, a q for which the
+// search has feasible and infeasible moves
+static long double middle_weight(MN& mn)
+{
+    long double logq = 0.0;
+    for (auto potential : mn.potentials)
+        logq += (potential->table.min() + potential->table.max()) / 2;
+    return logq;
+}
+
+static void benchmark_kernels(int seed)
+{
+    std::mt19937 generator(seed);
+    for (int n : {32, 100}) {
+        string filename = "cmpe_bench_grid" + to_string(n) + ".uai";
+        write_grid(filename, n, 2, generator);
+        run_benchmark("readMN/grid" + to_string(n), n * n, [&](long long iterations) {
+            for (long long i = 0; i < iterations; i++) {
+                MN mn;
+                mn.readMN(filename);
+                sink = mn.potentials.size();
+                delete_network(mn);
+            }
+        });
+        MN mn;
+        mn.readMN(filename);
+        std::remove(filename.c_str());
+        for (auto variable : mn.variables)
+            variable->value = generator() % variable->domain_size;
+        run_benchmark("MN::getValue/grid" + to_string(n), mn.potentials.size(), [&](long long iterations) {
+            long double value = 0.0;
+            for (long long i = 0; i < iterations; i++)
+                value += mn.getValue();
+            sink = value;
+        });
+        for (int k : {1, 3}) {
+            string suffix = "/grid" + to_string(n) + "/k" + to_string(k);
+            run_benchmark("findKseparator" + suffix, n * n, [&](long long iterations) {
+                for (long long i = 0; i < iterations; i++) {
+                    vector<Variable*> cut_variables;
+                    sink = mn.findKseparator(k, cut_variables).size();
+                }
+            });
+            vector<Variable*> cut_variables;
+            vector<set<int> > components = mn.findKseparator(k, cut_variables);
+            run_benchmark("generate_buckets" + suffix, mn.potentials.size(), [&](long long iterations) {
+                for (long long i = 0; i < iterations; i++)
+                    sink = mn.generate_buckets(components).size();
+            });
+        }
+    }
+    // Addressing over scopes of binary variables
+    for (int size : {2, 4, 8, 16}) {
+        vector<Variable*> scope;
+        for (int v = 0; v < size; v++)
+            scope.push_back(new Variable(v, 2));
+        long long domain_size = Variable::getDomainSize(scope);
+        run_benchmark("Variable::setAddress/scope" + to_string(size), 0, [&](long long iterations) {
+            for (long long i = 0; i < iterations; i++)
+                Variable::setAddress(scope, i & (domain_size - 1));
+            sink = scope[0]->value;
+        });
+        run_benchmark("Variable::getAddress/scope" + to_string(size), 0, [&](long long iterations) {
+            long long total = 0;
+            for (long long i = 0; i < iterations; i++) {
+                scope[i % size]->value ^= 1;
+                total += Variable::getAddress(scope);
+            }
+            sink = total;
+        });
+        for (auto variable : scope)
+            delete variable;
+    }
+    // Product of the potentials of a grid inside a component of 4 to 16 variables (the first
+    // rows of the grid), as built for every component table
+    string filename = "cmpe_bench_grid8.uai";
+    write_grid(filename, 8, 2, generator);
+    MN grid;
+    grid.readMN(filename);
+    std::remove(filename.c_str());
+    for (int size : {4, 8, 12, 16}) {
+        vector<Variable*> component(grid.variables.begin(), grid.variables.begin() + size);
+        vector<Potential*> functions;
+        for (auto potential : grid.potentials) {
+            bool inside = true;
+            for (auto variable : potential->variables)
+                inside = inside && variable->id < size;
+            if (inside)
+                functions.push_back(potential);
+        }
+        run_benchmark("Potential product/vars" + to_string(size), 1LL << size, [&](long long iterations) {
+            for (long long i = 0; i < iterations; i++) {
+                Potential product(functions, component);
+                sink = product.table.size();
+            }
+        });
+    }
+    // Greedy MCKP over random bins, with a capacity halfway between the cheapest and the
+    // costliest items
+    std::uniform_real_distribution<double> entry(-5.0, 5.0);
+    for (int bins : {10, 100, 1000}) {
+        for (int items : {4, 64, 1024}) {
+            if ((long long) bins * items > 200000)
+                continue;
+            vector<vector<long double> > weights(bins, vector<long double>(items));
+            vector<vector<long double> > profits(bins, vector<long double>(items));
+            long double capacity = 0.0;
+            for (int b = 0; b < bins; b++) {
+                for (int j = 0; j < items; j++) {
+                    weights[b][j] = entry(generator);
+                    profits[b][j] = entry(generator);
+                }
+                capacity += (*std::min_element(weights[b].begin(), weights[b].end()) +
+                             *std::max_element(weights[b].begin(), weights[b].end())) / 2;
+            }
+            vector<long long> solution;
+            run_benchmark("greedy_solve_MCKP/bins" + to_string(bins) + "/items" + to_string(items), (double) bins * items,
+                          [&](long long iterations) {
+                for (long long i = 0; i < iterations; i++)
+                    sink = greedy_solve_MCKP(weights, profits, capacity, solution);
+            });
+        }
+    }
+}
+
+// Evaluation of a grid with shuffled labels and product of the potentials of a 4x4 block of it,
+// as read and after MN::reorder renumbered its variables and potentials, for the same assignment
+static void benchmark_reorder(int seed)
+{
+    std::mt19937 generator(seed);
+    int n = 60;
+    string filename = "cmpe_bench_shuffled" + to_string(n) + ".uai";
+    vector<int> label = write_grid(filename, n, 2, generator, true);
+    vector<int> values(n * n);
+    for (int v = 0; v < n * n; v++)
+        values[v] = generator() % 2;
+    for (bool reordered : {false, true}) {
+        string suffix = "/shuffled" + to_string(n) + (reordered ? "/reordered" : "");
+        // The reordered variables are not freed: reorder moves them to one block
+        MN mn;
+        mn.readMN(filename);
+        if (reordered)
+            mn.reorder(mn);
+        // index[l]: index of the variable labelled l in the file
+        vector<int> index(n * n);
+        for (int v = 0; v < n * n; v++)
+            index[mn.original_variable(v)] = v;
+        for (int l = 0; l < n * n; l++)
+            mn.variables[index[l]]->value = values[l];
+        run_benchmark("MN::getValue" + suffix, mn.potentials.size(), [&](long long iterations) {
+            long double value = 0.0;
+            for (long long i = 0; i < iterations; i++)
+                value += mn.getValue();
+            sink = value;
+        });
+        set<int> block;
+        for (int r = 0; r < 4; r++)
+            for (int c = 0; c < 4; c++)
+                block.insert(index[label[r * n + c]]);
+        vector<Variable*> component;
+        for (int v : block)
+            component.push_back(mn.variables[v]);
+        vector<Potential*> functions;
+        for (auto potential : mn.potentials) {
+            bool inside = true;
+            for (auto variable : potential->variables)
+                inside = inside && block.count(variable->id) > 0;
+            if (inside)
+                functions.push_back(potential);
+        }
+        run_benchmark("Potential product/block16" + suffix, 1LL << block.size(), [&](long long iterations) {
+            for (long long i = 0; i < iterations; i++) {
+                Potential product(functions, component);
+                sink = product.table.size();
+            }
+        });
+    }
+    std::remove(filename.c_str());
+}
+
+// Iterations per second of the local search that run_experiments_neurips runs for every k, on
+// a grid with q halfway between its smallest and largest log-weights, once the search started
+static void benchmark_search(int seed, double seconds)
+{
+    std::mt19937 generator(seed);
+    for (int n : {16, 32}) {
+        string filename1 = "cmpe_bench_weight" + to_string(n) + ".uai";
+        string filename2 = "cmpe_bench_value" + to_string(n) + ".uai";
+        write_grid(filename1, n, 2, generator);
+        write_grid(filename2, n, 2, generator);
+        MN mn1, mn2;
+        mn1.readMN(filename1);
+        mn2.readMN2(filename2, mn1);
+        std::remove(filename1.c_str());
+        std::remove(filename2.c_str());
+        long double logq = middle_weight(mn1);
+        // Components of k = 5 on the larger grid are too large to build within seconds
+        for (int k : {1, 3, 5}) {
+            if (n > 16 && k > 3)
+                continue;
+            string name = "search/grid" + to_string(n) + "/k" + to_string(k);
+            if (!filter.empty() && name.find(filter) == string::npos)
+                continue;
+            // Nanoseconds per iteration and iterations of every repetition; the decomposition and
+            // the component tables built by start_search are not timed
+            vector<pair<double, long long> > times;
+            for (int r = 0; r < repetitions; r++) {
+                srand(seed);
+                // The statistics and status lines of the search are not part of the benchmark
+                ofstream null_out;
+                std::streambuf* cout_buffer = cout.rdbuf(nullptr);
+                std::streambuf* cerr_buffer = cerr.rdbuf(nullptr);
+                SearchState s;
+                mn1.start_search(mn2, logq, k, s, vector<int>());
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                mn1.search(mn2, logq, s, seconds, null_out);
+                double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                long long iterations = s.num_assignments_explored;
+                mn1.finish_search(s, nullptr);
+                cout.rdbuf(cout_buffer);
+                cerr.rdbuf(cerr_buffer);
+                cout.clear();
+                cerr.clear();
+                if (iterations > 0)
+                    times.push_back(make_pair(elapsed * 1e9 / iterations, iterations));
+            }
+            if (times.empty()) {
+                cout << std::left << std::setw(44) << name << "   no iteration completed" << endl;
+                continue;
+            }
+            std::sort(times.begin(), times.end());
+            const pair<double, long long>& median = times[times.size() / 2];
+            BenchmarkResult result = {name, median.second, (int) times.size(), median.first, times.front().first,
+                                      times.back().first, 0};
+            results.push_back(result);
+            cout << std::left << std::setw(44) << name << std::right << std::setw(16) << std::fixed << std::setprecision(1)
+                 << result.real_time << " ns" << std::setw(14) << median.second << std::setw(16) << std::setprecision(1)
+                 << 1e9 / median.first << " iterations/s" << endl;
+        }
+    }
+}
+
+// Results in the layout of Google Benchmark's JSON output, read by bench_compare.py
+static void write_json(const string& filename)
+{
+    ofstream out(filename, ofstream::out);
+    if (!out.good()) {
+        cerr << "Cannot write " << filename << "\n";
+        exit(-1);
+    }
+    out << "{\n  \"context\": {\"executable\": \"cmpe_bench\", \"min_time\": " << min_seconds
+        << ", \"repetitions\": " << repetitions << "},\n  \"benchmarks\": [";
+    out << std::setprecision(10);
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchmarkResult& result = results[i];
+        out << (i == 0 ? "\n" : ",\n") << "    {\"name\": \"" << result.name << "\", \"iterations\": " << result.iterations
+            << ", \"repetitions\": " << result.repetitions << ", \"real_time\": " << result.real_time
+            << ", \"min_time\": " << result.min_time << ", \"max_time\": " << result.max_time << ", \"time_unit\": \"ns\"";
+        if (result.items > 0)
+            out << ", \"items_per_second\": " << result.items * 1e9 / result.real_time;
+        out << "}";
+    }
+    out << "\n  ]\n}\n";
+    out.close();
+}
+
+/*
+ * Benchmarks of the kernels of CMPE on synthetic grids and MCKPs, with and without reordering,
+ * and of the iterations per second of its local search
+ */
+int main(int argc, char *argv[]) {
+    string json_filename;
+    double search_seconds = 2.0;
+    int seed = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0) {
+            json_filename = argv[i + 1];
+        } else if (strcmp(argv[i], "-t") == 0) {
+            min_seconds = atof(argv[i + 1]);
+        } else if (strcmp(argv[i], "-r") == 0) {
+            repetitions = std::max(1, atoi(argv[i + 1]));
+        } else if (strcmp(argv[i], "-f") == 0) {
+            filter = argv[i + 1];
+        } else if (strcmp(argv[i], "-e2e") == 0) {
+            search_seconds = atof(argv[i + 1]);
+        } else if (strcmp(argv[i], "-s") == 0) {
+            seed = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-h") == 0) {
+            print_help(argv[0]);
+            exit(-1);
+        }
+    }
+    cout << std::left << std::setw(44) << "benchmark" << std::right << std::setw(19) << "time/op" << std::setw(14)
+         << "iterations" << endl;
+    benchmark_kernels(seed);
+    benchmark_reorder(seed);
+    if (search_seconds > 0)
+        benchmark_search(seed, search_seconds);
+    if (!json_filename.empty())
+        write_json(json_filename);
+    return 0;
+}
@@ -0,0 +1,342 @@
+/*
+ * main_generate_mn.cpp
+ *
+ *
+ *      Authors: Sara Rouhani,Tahrima Rahman,Vibhav Gogate. The University of Texas at Dallas
+ *      Contacts: {sara.rouhani,tahrima.rahman,vibhav.gogate}@utdallas.edu
+ *
+ *      MIT License
+ *
+ *      Permission is hereby granted, free of charge, to any person obtaining a copy
+ *      of this software and associated documentation files (the "Software"), to deal
+ *      in the Software without restriction, including without limitation the rights
+ *      to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *      copies of the Software, and to permit persons to whom the Software is
+ *      furnished to do so, subject to the following conditions:
+ *
+ *      The above copyright notice and this permission notice shall be included in all
+ *      copies or substantial portions of the Software.
+ *
+ *      THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *      IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *      FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *      AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *      LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *      OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *      SOFTWARE.
+ */
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <random>
+#include <algorithm>
+#include <numeric>
+
+#include "StreamWriter.h"
+
+using namespace std;
+
+void print_help(const string &program_name) {
+    cerr << "Usage: " << program_name << " -o1 <uaifilename1> -o2 <uaifilename2>\n";
+    cerr << "\t Other Options: [-type -n -d -a -k -corr -sigma -unary -s ]\n";
+    cerr << "-------------------------------------------------------------------------\n";
+    cerr << "\t\t Details on Required Option\n";
+    cerr << "\t\t\t uaifilename1: the weight network (uaifilename1 of CMPE) is written here\n";
+    cerr << "\t\t\t uaifilename2: the value network (uaifilename2 of CMPE) is written here\n";
+    cerr << "-------------------------------------------------------------------------\n";
+    cerr << "\t\t Details on Other Options and Default values\n";
+    cerr << "\t\t\t -type [string]: grid, regular (random regular hypergraph), ktree (planted treewidth)\n";
+    cerr << "\t\t\t                or cliques (chain of cliques); default grid\n";
+    cerr << "\t\t\t -n       [int]: number of variables; default 100\n";
+    cerr << "\t\t\t -d       [int]: domain size of every variable; default 2\n";
+    cerr << "\t\t\t -a       [int]: variables of a potential for regular (default 2), size of a clique for cliques (default 3)\n";
+    cerr << "\t\t\t -k       [int]: potentials of every variable for regular, treewidth for ktree; default 3\n";
+    cerr << "\t\t\t -corr   [real]: correlation in [-1,1] of the log-entries of the two networks; 1 makes the\n";
+    cerr << "\t\t\t                networks equal (subset-sum-like), 0 independent; default 0\n";
+    cerr << "\t\t\t -sigma  [real]: standard deviation of the log-entries; default 1\n";
+    cerr << "\t\t\t -unary   [int]: 1 adds a potential over every variable; default 1\n";
+    cerr << "\t\t\t -s       [int]: Seed for Repeatability; default 1000000\n";
+}
+
+/*
+ * Scopes of the potentials of the generated structure, flattened: the scope of potential p is
+ * variables[offsets[p]] to variables[offsets[p + 1] - 1]
+ */
+struct Structure {
+    vector<int> variables;
+    vector<long long> offsets;
+    Structure() : offsets(1, 0) {}
+    int size() const { return offsets.size() - 1; }
+    long long scope_size(int p) const { return offsets[p + 1] - offsets[p]; }
+    void add(const int* scope, int size) {
+        variables.insert(variables.end(), scope, scope + size);
+        offsets.push_back(variables.size());
+    }
+};
+
+// Right and down neighbours on a grid of ceil(sqrt(n)) columns; the last row may be partial
+static void generate_grid(Structure& structure, int n)
+{
+    int width = (int) ceil(sqrt((double) n));
+    for (int v = 0; v < n; v++) {
+        int right[2] = {v, v + 1};
+        int down[2] = {v, v + width};
+        if ((v + 1) % width != 0 && v + 1 < n)
+            structure.add(right, 2);
+        if (v + width < n)
+            structure.add(down, 2);
+    }
+}
+
+// Configuration model: k copies of every variable are shuffled and cut into potentials of a
+// variables; potentials repeating a variable or another potential swap one of their copies
+// with a random copy until none is left
+static void generate_regular(Structure& structure, int n, int a, int k, std::mt19937& generator)
+{
+    vector<int> copies((size_t) n * k);
+    for (size_t i = 0; i < copies.size(); i++)
+        copies[i] = i / k;
+    std::shuffle(copies.begin(), copies.end(), generator);
+    long long num_potentials = copies.size() / a;
+    vector<int> sorted;
+    vector<long long> order(num_potentials);
+    for (int pass = 0; ; pass++) {
+        sorted = copies;
+        for (long long p = 0; p < num_potentials; p++)
+            std::sort(sorted.begin() + p * a, sorted.begin() + (p + 1) * a);
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](long long p1, long long p2) {
+            return std::lexicographical_compare(sorted.begin() + p1 * a, sorted.begin() + (p1 + 1) * a,
+                                                sorted.begin() + p2 * a, sorted.begin() + (p2 + 1) * a);
+        });
+        vector<long long> bad;
+        for (long long i = 0; i < num_potentials; i++) {
+            long long p = order[i];
+            bool repeated = std::adjacent_find(sorted.begin() + p * a, sorted.begin() + (p + 1) * a) !=
+                            sorted.begin() + (p + 1) * a;
+            if (!repeated && i > 0)
+                repeated = std::equal(sorted.begin() + p * a, sorted.begin() + (p + 1) * a,
+                                      sorted.begin() + order[i - 1] * a);
+            if (repeated)
+                bad.push_back(p);
+        }
+        if (bad.empty())
+            break;
+        if (pass == 1000) {
+            cerr << "Could not build a regular structure with " << n << " variables, -k " << k << " and -a " << a
+                 << "\n";
+            exit(-1);
+        }
+        std::uniform_int_distribution<size_t> position(0, copies.size() - 1);
+        for (auto p : bad)
+            std::swap(copies[p * a + generator() % a], copies[position(generator)]);
+    }
+    for (long long p = 0; p < num_potentials; p++)
+        structure.add(copies.data() + p * a, a);
+}
+
+// Random k-tree: every new variable is joined to k variables of a random (k+1)-clique, which
+// makes a new (k+1)-clique; the treewidth is k. Pairwise potentials over the edges, with the
+// variables relabelled at random so that the order of the file does not reveal the tree
+static void generate_ktree(Structure& structure, int n, int k, std::mt19937& generator)
+{
+    vector<int> label(n);
+    std::iota(label.begin(), label.end(), 0);
+    std::shuffle(label.begin(), label.end(), generator);
+    vector<int> cliques;
+    for (int v = 0; v <= k; v++) {
+        cliques.push_back(v);
+        for (int u = 0; u < v; u++) {
+            int edge[2] = {label[u], label[v]};
+            structure.add(edge, 2);
+        }
+    }
+    for (int v = k + 1; v < n; v++) {
+        size_t clique = generator() % (cliques.size() / (k + 1));
+        int dropped = generator() % (k + 1);
+        for (int l = 0; l <= k; l++) {
+            if (l == dropped)
+                continue;
+            int u = cliques[clique * (k + 1) + l];
+            cliques.push_back(u);
+            int edge[2] = {label[u], label[v]};
+            structure.add(edge, 2);
+        }
+        cliques.push_back(v);
+    }
+}
+
+// Cliques of a variables, consecutive cliques sharing one variable, with one potential over
+// every clique; the last clique may be smaller
+static void generate_cliques(Structure& structure, int n, int a)
+{
+    vector<int> clique;
+    for (int first = 0; first + 1 < n; first += a - 1) {
+        clique.clear();
+        for (int v = first; v < first + a && v < n; v++)
+            clique.push_back(v);
+        structure.add(clique.data(), clique.size());
+    }
+}
+
+int main(int argc, char *argv[]) {
+    string filename1, filename2;
+    string type = "grid";
+    int n = 100;
+    int domain_size = 2;
+    int arity = -1;
+    int k = 3;
+    double corr = 0.0;
+    double sigma = 1.0;
+    bool unary = true;
+    unsigned long long seed = 1000000L;
+    bool option1 = false, option2 = false;
+    if (argc == 1) {
+        print_help(argv[0]);
+        exit(-1);
+    }
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-o1") == 0) {
+            filename1 = argv[i + 1];
+            option1 = true;
+        } else if (strcmp(argv[i], "-o2") == 0) {
+            filename2 = argv[i + 1];
+            option2 = true;
+        } else if (strcmp(argv[i], "-type") == 0) {
+            type = argv[i + 1];
+        } else if (strcmp(argv[i], "-n") == 0) {
+            n = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-d") == 0) {
+            domain_size = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-a") == 0) {
+            arity = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-k") == 0) {
+            k = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-corr") == 0) {
+            corr = atof(argv[i + 1]);
+        } else if (strcmp(argv[i], "-sigma") == 0) {
+            sigma = atof(argv[i + 1]);
+        } else if (strcmp(argv[i], "-unary") == 0) {
+            unary = atoi(argv[i + 1]) != 0;
+        } else if (strcmp(argv[i], "-s") == 0) {
+            seed = atoll(argv[i + 1]);
+        } else if (strcmp(argv[i], "-h") == 0) {
+            print_help(argv[0]);
+            exit(-1);
+        }
+    }
+    if (!option1 || !option2) {
+        cerr << "Output files not specified\n";
+        print_help(argv[0]);
+        exit(-1);
+    }
+    if (arity < 0)
+        arity = type == "cliques" ? 3 : 2;
+    if (n < 1 || domain_size < 1 || arity < 1 || k < 1 || corr < -1.0 || corr > 1.0 || sigma < 0.0) {
+        cerr << "Need -n, -d, -a and -k of at least 1, -corr in [-1,1] and -sigma of at least 0\n";
+        print_help(argv[0]);
+        exit(-1);
+    }
+    std::mt19937 generator(seed);
+    Structure structure;
+    if (type == "grid") {
+        generate_grid(structure, n);
+    } else if (type == "regular") {
+        if (arity < 2 || k >= n || ((long long) n * k) % arity != 0) {
+            cerr << "-type regular needs -a of at least 2, -k below -n and -n times -k divisible by -a\n";
+            exit(-1);
+        }
+        generate_regular(structure, n, arity, k, generator);
+    } else if (type == "ktree") {
+        if (k >= n) {
+            cerr << "-type ktree needs -k below -n\n";
+            exit(-1);
+        }
+        generate_ktree(structure, n, k, generator);
+    } else if (type == "cliques") {
+        if (arity < 2) {
+            cerr << "-type cliques needs -a of at least 2\n";
+            exit(-1);
+        }
+        generate_cliques(structure, n, arity);
+    } else {
+        cerr << "Unknown -type " << type << "\n";
+        print_help(argv[0]);
+        exit(-1);
+    }
+    // Tables of more than 2^24 entries are refused rather than written for hours
+    long long max_table_size = 1;
+    long long largest_scope = unary ? 1 : 0;
+    for (int p = 0; p < structure.size(); p++)
+        largest_scope = std::max(largest_scope, structure.scope_size(p));
+    for (long long l = 0; l < largest_scope; l++) {
+        max_table_size *= domain_size;
+        if (max_table_size > (1LL << 24)) {
+            cerr << "Potentials of " << largest_scope << " variables of domain size " << domain_size
+                 << " have too many entries\n";
+            exit(-1);
+        }
+    }
+
+    long long num_potentials = (unary ? n : 0) + structure.size();
+    StreamWriter out1(filename1), out2(filename2);
+    StreamWriter* outs[2] = {&out1, &out2};
+    for (auto out : outs) {
+        out->put("MARKOV\n");
+        out->put((long long) n);
+        out->put('\n');
+        for (int v = 0; v < n; v++) {
+            out->put((long long) domain_size);
+            out->put(v + 1 < n ? ' ' : '\n');
+        }
+        out->put(num_potentials);
+        out->put('\n');
+        if (unary) {
+            for (int v = 0; v < n; v++) {
+                out->put("1 ");
+                out->put((long long) v);
+                out->put('\n');
+            }
+        }
+        for (int p = 0; p < structure.size(); p++) {
+            out->put(structure.scope_size(p));
+            for (long long i = structure.offsets[p]; i < structure.offsets[p + 1]; i++) {
+                out->put(' ');
+                out->put((long long) structure.variables[i]);
+            }
+            out->put('\n');
+        }
+    }
+    // The log-entries of the weight network are sigma*z1 and those of the value network
+    // sigma*(corr*z1 + sqrt(1-corr^2)*z2) for independent standard normal z1 and z2
+    std::normal_distribution<double> normal(0.0, 1.0);
+    double independent = sqrt(std::max(0.0, 1.0 - corr * corr));
+    long long num_entries = 0;
+    for (long long p = 0; p < num_potentials; p++) {
+        long long size = 1;
+        long long scope_size = p < (unary ? n : 0) ? 1 : structure.scope_size(p - (unary ? n : 0));
+        for (long long l = 0; l < scope_size; l++)
+            size *= domain_size;
+        num_entries += size;
+        for (auto out : outs) {
+            out->put('\n');
+            out->put(size);
+            out->put('\n');
+        }
+        for (long long e = 0; e < size; e++) {
+            double z1 = normal(generator);
+            double z2 = normal(generator);
+            out1.put(exp(sigma * z1), 6);
+            out2.put(exp(sigma * (corr * z1 + independent * z2)), 6);
+            out1.put(e + 1 < size ? ' ' : '\n');
+            out2.put(e + 1 < size ? ' ' : '\n');
+        }
+    }
+    cout << "Variables " << n << ", potentials " << num_potentials << ", entries " << num_entries
+         << " in each network\n";
+    return 0;
+}
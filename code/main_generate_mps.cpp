@@ -30,7 +30,11 @@
 #include <fstream>
 #include <cstring>
 #include <algorithm>
+#include <iomanip>
+#include <limits>
+#ifdef USE_ORTOOLS
 #include <ortools/linear_solver/linear_solver.h>
+#endif
 
 #include "MN.h"
 
@@ -38,20 +42,199 @@ using namespace std;
 
 void print_help(const string &program_name) {
     cerr << "Usage: " << program_name << " -m1 <uaifilename1> -m2 <uaifilename2> -o <outfilename> -q <q-value>\n";
+    cerr << "\t Other Options: [-compact -format -ortools -a -start -e -presolve -reorder ]\n";
     cerr << "-------------------------------------------------------------------------\n";
     cerr << "\t\t Details on Required Option\n";
     cerr << "\t\t\t uaifilename1 and uaifilename2: are evidence instantiated Markov networks in UAI format\n";
     cerr << "\t\t\t outfilename: mpsfile will be stored here\n";
     cerr << "\t\t\t q-value: (Real number): constraint on weight of the assignment in CMPE\n";
     cerr << "-------------------------------------------------------------------------\n";
+    cerr << "\t\t Details on Other Options and Default values\n";
+    cerr << "\t\t\t -compact [int]: 1 writes the local-polytope formulation with one indicator per variable value;\n";
+    cerr << "\t\t\t                0 the pairwise consistency formulation (binary domains only); default 0\n";
+    cerr << "\t\t\t -format [string]: mps (free MPS) or lp (CPLEX LP); default mps\n";
+    cerr << "\t\t\t -ortools [int]: 1 builds the model with OR-tools and exports it as MPS; default 0 (streamed)\n";
+    cerr << "\t\t\t -a [string]: assignments written by CMPE -a; the best one satisfying the constraint is the MIP start\n";
+    cerr << "\t\t\t -start [string]: write the MIP start (name value per column, .mst/.sol) to this file\n";
+    cerr << "\t\t\t -presolve [int]: 1 adds potentials to potentials over a superset of their scope and folds constant ones; default 0\n";
+    cerr << "\t\t\t -reorder [int]: 1 renumbers variables by reverse Cuthill-McKee and sorts potentials to match; default 0\n";
+    cerr << "\t\t\t -e [string]: UAI evidence file; both networks are conditioned on it when they are read\n";
 
 }
 
 
 int GlobalSearchOptions::print_interval = 1; //print stat every 100 seconds
+int GlobalSearchOptions::tabu_tenure = 0;
+bool GlobalSearchOptions::tabu_aspiration = true;
+int GlobalSearchOptions::cache_size = 0;
+int GlobalSearchOptions::lns_size = 0;
+int GlobalSearchOptions::schedule = 0;
+bool GlobalSearchOptions::warm_start = false;
+long double GlobalSearchOptions::gap = 0.0;
+int GlobalSearchOptions::beam_size = 0;
+bool GlobalSearchOptions::screen = false;
+int GlobalSearchOptions::batch_size = 0;
 
 
+// Reads the assignments written by CMPE -a, one per line: the number of variables followed by
+// their values, evidence included. Assignments contradicting the evidence are skipped
+vector<vector<int> > read_assignments(const string &filename, MN &mn) {
+    ifstream infile(filename);
+    if (!infile.good()) {
+        cerr << "Could not open " << filename << "\n";
+        exit(-1);
+    }
+    const vector<Variable*>& uai_variables = mn.uai_variables.empty() ? mn.variables : mn.uai_variables;
+    vector<vector<int> > assignments;
+    int n;
+    while (infile >> n) {
+        if (n != uai_variables.size()) {
+            cerr << "Assignment over " << n << " variables in " << filename << "\n";
+            exit(-1);
+        }
+        vector<int> assignment(n);
+        for (int v = 0; v < n; v++)
+            infile >> assignment[v];
+        vector<int> values;
+        if (mn.reduce_assignment(assignment, values))
+            assignments.push_back(values);
+        else
+            cerr << "Skipping an assignment that contradicts the evidence or a hard constraint\n";
+    }
+    return assignments;
+}
+
+/*
+ * Size of a MILP formulation: rows and columns, and nonzeros of the constraint matrix
+ */
+struct FormulationSize {
+    long long rows;
+    long long columns;
+    long long nonzeros;
+};
+
+// Entries of a value potential that are not -inf, i.e. that get a column
+long long allowed_entries(Potential* potential) {
+    return potential->table.size() - potential->table.forbidden();
+}
+
+// Size of the formulation of writeMPS: one column per allowed entry of every potential, a row
+// per potential choosing one entry, and two rows per pair of potentials sharing a variable
+FormulationSize pairwise_size(MN& mn, MN& mn_c) {
+    FormulationSize size = {1, 0, 0};
+    vector<vector<int> > var2funcids(mn.variables.size());
+    vector<long long> allowed(mn.potentials.size());
+    for (int i = 0; i < mn.potentials.size(); i++) {
+        allowed[i] = allowed_entries(mn_c.potentials[i]);
+        size.columns += allowed[i];
+        size.nonzeros += 2 * allowed[i];
+        size.rows++;
+        for (auto variable : mn.potentials[i]->variables)
+            var2funcids[variable->id].push_back(i);
+    }
+    for (int a = 0; a < mn.variables.size(); a++) {
+        for (int b = 0; b < var2funcids[a].size(); b++) {
+            for (int c = b + 1; c < var2funcids[a].size(); c++) {
+                size.rows += 2;
+                size.nonzeros += allowed[var2funcids[a][b]] + allowed[var2funcids[a][c]];
+            }
+        }
+    }
+    return size;
+}
+
+// Size of the formulation of writeCompactMPS
+FormulationSize compact_size(MN& mn, MN& mn_c) {
+    FormulationSize size = {1 + (long long) mn.variables.size(), 0, 0};
+    for (auto variable : mn.variables) {
+        size.columns += variable->domain_size;
+        size.nonzeros += variable->domain_size;
+    }
+    for (int n = 0; n < 2; n++) {
+        for (int i = 0; i < mn.potentials.size(); i++) {
+            Potential* potential = n == 0 ? mn.potentials[i] : mn_c.potentials[i];
+            // A value potential over the scope of its weight potential shares its columns
+            bool shared = mn_c.potentials[i]->variables == mn.potentials[i]->variables;
+            if (n == 1 && shared)
+                continue;
+            long long allowed = n == 1 || shared ? allowed_entries(mn_c.potentials[i]) : potential->table.size();
+            size.columns += allowed;
+            if (n == 0)
+                size.nonzeros += allowed;
+            for (auto variable : potential->variables) {
+                size.rows += variable->domain_size;
+                size.nonzeros += allowed + variable->domain_size;
+            }
+        }
+    }
+    return size;
+}
+
+#ifdef USE_ORTOOLS
 using namespace operations_research;
+
+/*
+ * Local-polytope formulation of CMPE. y[v][d] = 1 iff variable v takes value d, and x[i][e] is
+ * the indicator of entry e of potential i, linked to its variables by the marginalization rows
+ *      \sum_{e | v=d in e} x[i][e] = y[v][d]   for every v in the scope of i and every value d
+ * Once y is integral these rows force x[i][e] = 1 for the single entry consistent with y, so
+ * only y needs to be integer. The number of rows is linear in the total scope size times the
+ * domain size and any domain size is supported.
+ */
+void MN::writeCompactMPS(MN& mn_c, long double logp, ostream &out1) {
+    MPSolver solver("compact_mip_program",
+                    MPSolver::CBC_MIXED_INTEGER_PROGRAMMING);
+    const double infinity = solver.infinity();
+    vector<vector<const MPVariable*> > y(variables.size());
+    for (int v = 0; v < variables.size(); v++) {
+        MPConstraint* constraint = solver.MakeRowConstraint(1.0, 1.0, "V" + to_string(original_variable(v)));
+        for (int d = 0; d < variables[v]->domain_size; d++) {
+            y[v].push_back(solver.MakeBoolVar("y" + to_string(original_variable(v)) + "_" + to_string(d)));
+            constraint->SetCoefficient(y[v][d], 1.0);
+        }
+    }
+    // Columns of the entries of a potential and the rows linking them to the indicators, named
+    // as by writeMILP. Entries whose value is -inf are fixed to 0
+    auto add_potential = [&](Potential* potential, Potential* values, const string& column, const string& row) {
+        vector<const MPVariable*> x(potential->table.size());
+        for (int e = 0; e < x.size(); e++) {
+            bool forbidden = values && values->table[e] == -numeric_limits<long double>::infinity();
+            x[e] = solver.MakeNumVar(0.0, forbidden ? 0.0 : 1.0, column + "_" + to_string(e));
+        }
+        for (int l = 0; l < potential->variables.size(); l++) {
+            Variable* variable = potential->variables[l];
+            vector<MPConstraint*> marginals(variable->domain_size);
+            for (int d = 0; d < variable->domain_size; d++) {
+                marginals[d] = solver.MakeRowConstraint(0.0, 0.0, row + "_" + to_string(l) + "_" + to_string(d));
+                marginals[d]->SetCoefficient(y[variable->id][d], -1.0);
+            }
+            for (int e = 0; e < x.size(); e++) {
+                Variable::setAddress(potential->variables, e);
+                marginals[variable->value]->SetCoefficient(x[e], 1.0);
+            }
+        }
+        return x;
+    };
+    MPConstraint* constraint1 = solver.MakeRowConstraint(-infinity, logp, "W");
+    MPObjective* const objective = solver.MutableObjective();
+    for (int i = 0; i < potentials.size(); i++) {
+        bool shared = mn_c.potentials[i]->variables == potentials[i]->variables;
+        vector<const MPVariable*> x = add_potential(potentials[i], shared ? mn_c.potentials[i] : nullptr,
+                                                    "x" + to_string(original_potential(i)), "M" + to_string(original_potential(i)));
+        for (int e = 0; e < x.size(); e++)
+            constraint1->SetCoefficient(x[e], potentials[i]->table[e]);
+        if (!shared)
+            x = add_potential(mn_c.potentials[i], mn_c.potentials[i], "z" + to_string(original_potential(i)), "N" + to_string(original_potential(i)));
+        for (int e = 0; e < x.size(); e++)
+            if (mn_c.potentials[i]->table[e] != -numeric_limits<long double>::infinity())
+                objective->SetCoefficient(x[e], -mn_c.potentials[i]->table[e]);
+    }
+    objective->SetMinimization();
+    string model_str;
+    solver.ExportModelAsMpsFormat(false, false, &model_str);
+    out1 << model_str;
+}
+
 void MN::writeMPS(MN& mn_c, long double logp, ostream &out1) {
 
     MPSolver solver("simple_mip_program",
@@ -70,11 +253,15 @@ void MN::writeMPS(MN& mn_c, long double logp, ostream &out1) {
         x[i]=vector<const MPVariable*> (g[i]->table.size());
         for(int j=0;j<x[i].size();j++){
             //x[i][j]=solver.MakeNumVar(0.0,1.0,"");
-            x[i][j]=solver.MakeBoolVar("");
+            // Entries whose value is -inf are hard constraints: fixed to 0
+            if (h[i]->table[j]==-numeric_limits<long double>::infinity())
+                x[i][j]=solver.MakeIntVar(0.0,0.0,"x"+to_string(original_potential(i))+"_"+to_string(j));
+            else
+                x[i][j]=solver.MakeBoolVar("x"+to_string(original_potential(i))+"_"+to_string(j));
         }
     }
     // Write the constraint that \sum_{i,j} g[i][j]*x[i][j] should be <=logp
-    MPConstraint* constraint1 = solver.MakeRowConstraint(-infinity, logp, "");
+    MPConstraint* constraint1 = solver.MakeRowConstraint(-infinity, logp, "W");
     for(int i=0;i<g.size();i++){
         int domain_size=Variable::getDomainSize(g[i]->variables);
         for(int j=0;j<domain_size;j++){
@@ -86,7 +273,7 @@ void MN::writeMPS(MN& mn_c, long double logp, ostream &out1) {
     // Hard constraint to make sure that exactly one value is chosen from each potential
     // Write the constraint that \sum_j x[i][j]=1 for each i
     for(int i=0;i<g.size();i++){
-        MPConstraint* constraint = solver.MakeRowConstraint(1.0, 1.0, "");
+        MPConstraint* constraint = solver.MakeRowConstraint(1.0, 1.0, "S"+to_string(original_potential(i)));
         for(int j=0;j<g[i]->table.size();j++){
             constraint->SetCoefficient(x[i][j],1.0);
         }
@@ -107,7 +294,10 @@ void MN::writeMPS(MN& mn_c, long double logp, ostream &out1) {
                 int j=var2funcids[A][c];
                 int dsize_j=Variable::getDomainSize(g[j]->variables);
                 for(int d=0;d<2;d++){
-                    MPConstraint *constraint = solver.MakeRowConstraint(1.0,1.0 , "");
+                    // Named as in MPSWriter.cpp: by the potentials without -reorder, the smaller first
+                    bool ordered=original_potential(i)<original_potential(j);
+                    MPConstraint *constraint = solver.MakeRowConstraint(1.0,1.0 , "P"+to_string(original_variable(A))+"_"+
+                        to_string(original_potential(ordered?i:j))+"_"+to_string(original_potential(ordered?j:i))+"_"+to_string(ordered?d:1-d));
                     for(int e=0;e<dsize_i;e++){
                         Variable::setAddress(g[i]->variables,e);
                         if (variables[a]->value==d){
@@ -133,7 +323,8 @@ void MN::writeMPS(MN& mn_c, long double logp, ostream &out1) {
         for(int j=0;j<domain_size;j++){
             Variable::setAddress(h[i]->variables,j);
             int entry=Variable::getAddress(h[i]->variables);
-            objective->SetCoefficient(x[i][j],-h[i]->table[entry]);
+            if (h[i]->table[entry]!=-numeric_limits<long double>::infinity())
+                objective->SetCoefficient(x[i][j],-h[i]->table[entry]);
         }
     }
     objective->SetMinimization();
@@ -181,6 +372,7 @@ void MN::writeMPS(MN& mn_c, long double logp, ostream &out1) {
     cout<<std::setprecision(20)<<"Value of objective = "<<objective_value<<endl;
      */
 }
+#endif
 
 /*
  * This program can be run in two modes
@@ -198,6 +390,14 @@ int main(int argc, char *argv[]) {
     int k = 15;
     int sampling_number = 1000;
     long double q;
+    bool compact = false;
+    bool lp = false;
+    bool ortools = false;
+    string assignment_filename;
+    string start_filename;
+    string evidence_filename;
+    bool presolve = false;
+    bool reorder = false;
     bool uaioption1 = false, uaioption2 = false, outoption = false, qoption = false;
     if (argc == 1) {
         print_help(argv[0]);
@@ -216,6 +416,27 @@ int main(int argc, char *argv[]) {
         } else if (strcmp(argv[i], "-q") == 0) {
             q = atof(argv[i + 1]);
             qoption = true;
+        } else if (strcmp(argv[i], "-compact") == 0) {
+            compact = atoi(argv[i + 1]) != 0;
+        } else if (strcmp(argv[i], "-format") == 0) {
+            if (strcmp(argv[i + 1], "lp") == 0) {
+                lp = true;
+            } else if (strcmp(argv[i + 1], "mps") != 0) {
+                cerr << "Unknown format " << argv[i + 1] << "\n";
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "-ortools") == 0) {
+            ortools = atoi(argv[i + 1]) != 0;
+        } else if (strcmp(argv[i], "-a") == 0) {
+            assignment_filename = argv[i + 1];
+        } else if (strcmp(argv[i], "-presolve") == 0) {
+            presolve = atoi(argv[i + 1]) != 0;
+        } else if (strcmp(argv[i], "-reorder") == 0) {
+            reorder = atoi(argv[i + 1]) != 0;
+        } else if (strcmp(argv[i], "-e") == 0) {
+            evidence_filename = argv[i + 1];
+        } else if (strcmp(argv[i], "-start") == 0) {
+            start_filename = argv[i + 1];
         } else if (strcmp(argv[i], "-h") == 0) {
             print_help(argv[0]);
             exit(-1);
@@ -242,15 +463,79 @@ int main(int argc, char *argv[]) {
         exit(-1);
     }
     MN mn1, mn2;
-    mn1.readMN(uai_filename1);
+    mn1.readMN(uai_filename1, evidence_filename);
     mn2.readMN2(uai_filename2,mn1);
+    mn1.hard_constraints(mn2);
+    if (presolve)
+        mn1.presolve(mn2);
+    if (reorder)
+        mn1.reorder(mn2);
+    mn1.share_tables(mn2);
     if (mn1.variables.size() != mn2.variables.size()) {
         cerr << "Variable size mismatch\n";
         cerr << "Code requires the two Markov networks be defined over the same set of variables\n";
         exit(-1);
     }
+    FormulationSize pairwise = pairwise_size(mn1, mn2), local = compact_size(mn1, mn2);
+    cout << "Pairwise formulation: rows = " << pairwise.rows << ", columns = " << pairwise.columns
+         << ", nonzeros = " << pairwise.nonzeros << endl;
+    cout << "Local-polytope formulation: rows = " << local.rows << ", columns = " << local.columns
+         << ", nonzeros = " << local.nonzeros << endl;
+    if (!compact) {
+        for (auto variable : mn1.variables) {
+            if (variable->domain_size > 2) {
+                cerr << "The pairwise formulation requires binary domains; use -compact 1\n";
+                exit(-1);
+            }
+        }
+        for (int i = 0; i < mn1.potentials.size(); i++) {
+            if (mn1.potentials[i]->variables != mn2.potentials[i]->variables) {
+                cerr << "The pairwise formulation requires potentials over the same scopes; use -compact 1\n";
+                exit(-1);
+            }
+        }
+    }
+    if (!start_filename.empty()) {
+        if (assignment_filename.empty()) {
+            cerr << "A MIP start requires an assignment file (-a)\n";
+            exit(-1);
+        }
+        // The best assignment satisfying the constraint of this q
+        vector<vector<int> > assignments = read_assignments(assignment_filename, mn1);
+        int best = -1;
+        long double best_value = 0;
+        for (int j = 0; j < assignments.size(); j++) {
+            mn1.set_assignment(assignments[j]);
+            if (mn1.getValue() <= q && (best < 0 || mn2.getValue() > best_value)) {
+                best = j;
+                best_value = mn2.getValue();
+            }
+        }
+        if (best < 0) {
+            cerr << "No assignment in " << assignment_filename << " satisfies the constraint\n";
+            exit(-1);
+        }
+        cout << std::setprecision(20) << "MIP start value = " << best_value << endl;
+        mn1.writeMIPStart(mn2, compact, assignments[best], start_filename);
+    }
+    if (!ortools) {
+        mn1.writeMILP(mn2, q, compact, lp, out_filename);
+        return 0;
+    }
+#ifdef USE_ORTOOLS
+    if (lp) {
+        cerr << "OR-tools export supports only the mps format\n";
+        exit(-1);
+    }
     ofstream out(out_filename, ofstream::out);
-    mn1.writeMPS(mn2,q,out);
+    if (compact)
+        mn1.writeCompactMPS(mn2, q, out);
+    else
+        mn1.writeMPS(mn2,q,out);
     out.close();
+#else
+    cerr << "generate_mps was built without OR-tools; configure with cmake -DWITH_ORTOOLS=ON\n";
+    exit(-1);
+#endif
     return 0;
 }
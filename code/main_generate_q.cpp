@@ -30,6 +30,8 @@
 #include <fstream>
 #include <cstring>
 #include <algorithm>
+#include <thread>
+#include <cmath>
 
 #include "MN.h"
 
@@ -37,14 +39,176 @@ using namespace std;
 
 void print_help(const string &program_name) {
     cerr << "Usage: " << program_name << " -m <uaifilename> -o <outfilename>\n";
+    cerr << "\t Other Options: [-n -g -s -threads -ib -me -spacing -e -presolve -reorder ]\n";
     cerr << "-------------------------------------------------------------------------\n";
     cerr << "\t\t Details on Required Option\n";
     cerr << "\t\t\t uaifilename: is an evidence instantiated Markov network in UAI format\n";
     cerr << "\t\t\t outfilename: q-values are stored in outfilename\n";
+    cerr << "-------------------------------------------------------------------------\n";
+    cerr << "\t\t Details on Other Options and Default values\n";
+    cerr << "\t\t\t -n       [int]: number of random assignments sampled; default 1000000\n";
+    cerr << "\t\t\t -g       [int]: q values are the minimum and the i/g quantiles, i=1..g; default 20\n";
+    cerr << "\t\t\t -s       [int]: Seed for Repeatability; default 1000000\n";
+    cerr << "\t\t\t -threads [int]: sampling threads, which do not change the samples; default number of cores\n";
+    cerr << "\t\t\t -ib      [int]: largest i-bound of the elimination computing the min and max log-weight\n";
+    cerr << "\t\t\t                for -spacing 1; default 10\n";
+    cerr << "\t\t\t -me      [int]: the i-bound is lowered until the messages of the elimination have at most\n";
+    cerr << "\t\t\t                this many entries; default 10000000\n";
+    cerr << "\t\t\t -spacing [int]: 0 writes quantiles; 1 writes g+1 q values evenly spaced between the min and max\n";
+    cerr << "\t\t\t                log-weight; 2 between the smallest and largest sample; default 0\n";
+    cerr << "\t\t\t -e    [string]: UAI evidence file; the network is conditioned on it when it is read\n";
+    cerr << "\t\t\t -presolve [int]: 1 adds potentials to potentials over a superset of their scope and folds constant ones; default 0\n";
+    cerr << "\t\t\t -reorder [int]: 1 renumbers variables by reverse Cuthill-McKee and sorts potentials to match; default 0\n";
+}
+
+/*
+ * Potentials flattened for batched evaluation: the table of potential p starts at offsets[p]
+ * and the entry of an assignment is at the sum of strides[p][l] times the value of scopes[p][l]
+ */
+struct FlatNetwork {
+    vector<double> tables;
+    vector<long long> offsets;
+    vector<vector<int> > scopes;
+    vector<vector<long long> > strides;
+    vector<int> domain_sizes;
+    FlatNetwork(MN& mn) {
+        for (auto variable : mn.variables)
+            domain_sizes.push_back(variable->domain_size);
+        for (auto potential : mn.potentials) {
+            offsets.push_back(tables.size());
+            tables.insert(tables.end(), potential->table.begin(), potential->table.end());
+            vector<int> scope;
+            vector<long long> stride;
+            // The first variable of a scope varies fastest, as in Variable::getAddress
+            long long multiplier = 1;
+            for (auto variable : potential->variables) {
+                scope.push_back(variable->id);
+                stride.push_back(multiplier);
+                multiplier *= variable->domain_size;
+            }
+            scopes.push_back(scope);
+            strides.push_back(stride);
+        }
+    }
+};
+
+// xorshift128+ generator; every thread has its own
+struct FastRandom {
+    unsigned long long s0, s1;
+    FastRandom(unsigned long long seed) {
+        s0 = splitmix(seed);
+        s1 = splitmix(seed);
+    }
+    static unsigned long long splitmix(unsigned long long& x) {
+        unsigned long long z = (x += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+    inline unsigned long long next() {
+        unsigned long long x = s0;
+        unsigned long long const y = s1;
+        s0 = y;
+        x ^= x << 23;
+        s1 = x ^ y ^ (x >> 17) ^ (y >> 26);
+        return s1 + y;
+    }
+    // Uniform value in [0, n)
+    inline int below(int n) {
+        return (int) (((next() >> 32) * (unsigned long long) n) >> 32);
+    }
+};
+
+// Largest log-weight of the network by max-sum elimination, or the smallest one when
+// minimize is set. The result is exact if no bucket exceeds i_bound and a bound otherwise;
+// achieved receives the log-weight of the decoded assignment, which lies between the bound and
+// the true extreme.
+long double extreme_weight(MN& mn, const vector<int>& order, int i_bound, bool minimize, long double& achieved, bool& exact)
+{
+    vector<Potential> negated(mn.potentials.size());
+    vector<Potential*> functions;
+    for (int i = 0; i < mn.potentials.size(); i++) {
+        if (!minimize) {
+            functions.push_back(mn.potentials[i]);
+            continue;
+        }
+        negated[i].variables = mn.potentials[i]->variables;
+        // Forbidden (-inf) entries stay forbidden
+        vector<long double> table;
+        for (auto entry : mn.potentials[i]->table)
+            table.push_back(std::isinf(entry) ? entry : -entry);
+        negated[i].table = std::move(table);
+        functions.push_back(&negated[i]);
+    }
+    vector<int> assignment;
+    long double bound = mn.max_sum_elimination(functions, order, i_bound, assignment, exact);
+    mn.set_assignment(assignment);
+    achieved = mn.getValue();
+    return minimize ? -bound : bound;
+}
+
+// Assignments are generated and evaluated this many at a time
+static const int SAMPLE_BATCH = 256;
+
+// Writes the log-weights of num_samples uniformly random assignments to weights. A batch is
+// stored variable by variable so that the entries of a potential are gathered for the whole batch at once.
+void sample_weights(const FlatNetwork* network, unsigned long long seed, long long num_samples, double* weights)
+{
+    FastRandom random(seed);
+    int num_variables = network->domain_sizes.size();
+    vector<int> values(num_variables * SAMPLE_BATCH);
+    vector<long long> address(SAMPLE_BATCH);
+    vector<double> batch(SAMPLE_BATCH);
+    for (long long first = 0; first < num_samples; first += SAMPLE_BATCH) {
+        int size = (int) std::min((long long) SAMPLE_BATCH, num_samples - first);
+        for (int v = 0; v < num_variables; v++) {
+            int* column = &values[v * SAMPLE_BATCH];
+            for (int b = 0; b < size; b++)
+                column[b] = random.below(network->domain_sizes[v]);
+        }
+        std::fill(batch.begin(), batch.end(), 0.0);
+        for (int p = 0; p < network->scopes.size(); p++) {
+            std::fill(address.begin(), address.end(), 0);
+            for (int l = 0; l < network->scopes[p].size(); l++) {
+                const int* column = &values[network->scopes[p][l] * SAMPLE_BATCH];
+                long long stride = network->strides[p][l];
+                for (int b = 0; b < size; b++)
+                    address[b] += stride * column[b];
+            }
+            const double* table = &network->tables[network->offsets[p]];
+            for (int b = 0; b < size; b++)
+                batch[b] += table[address[b]];
+        }
+        std::copy(batch.begin(), batch.begin() + size, weights + first);
+    }
+}
+
+// Samples are drawn in blocks of this many, block b with a generator seeded by seed + b, so that
+// they do not depend on the number of threads
+static const long long SAMPLE_BLOCK = 1 << 16;
+
+// Writes every stride-th block of samples from block first to its place in weights
+void sample_blocks(const FlatNetwork* network, unsigned long long seed, long long num_samples, int first, int stride,
+                   double* weights)
+{
+    for (long long block = first; block * SAMPLE_BLOCK < num_samples; block += stride) {
+        long long start = block * SAMPLE_BLOCK;
+        sample_weights(network, seed + block, std::min(SAMPLE_BLOCK, num_samples - start), weights + start);
+    }
 }
 
 
 int GlobalSearchOptions::print_interval = 1; //print stat every 100 seconds
+int GlobalSearchOptions::tabu_tenure = 0;
+bool GlobalSearchOptions::tabu_aspiration = true;
+int GlobalSearchOptions::cache_size = 0;
+int GlobalSearchOptions::lns_size = 0;
+int GlobalSearchOptions::schedule = 0;
+bool GlobalSearchOptions::warm_start = false;
+long double GlobalSearchOptions::gap = 0.0;
+int GlobalSearchOptions::beam_size = 0;
+bool GlobalSearchOptions::screen = false;
+int GlobalSearchOptions::batch_size = 0;
 
 /*
  * This program can be run in two modes
@@ -53,6 +217,16 @@ int GlobalSearchOptions::print_interval = 1; //print stat every 100 seconds
  */
 int main(int argc, char *argv[]) {
     string uai_filename,out_filename;
+    string evidence_filename;
+    bool presolve = false;
+    bool reorder = false;
+    long long num_samples = 1000000;
+    int grid = 20;
+    unsigned long long seed = 1000000L;
+    int num_threads = std::max(1u, std::thread::hardware_concurrency());
+    int i_bound = 10;
+    long long max_entries = 10000000;
+    int spacing = 0;
     bool uaioption = false, outoption = false;
     if (argc == 1) {
         print_help(argv[0]);
@@ -65,6 +239,26 @@ int main(int argc, char *argv[]) {
         } else if (strcmp(argv[i], "-o") == 0) {
             out_filename = argv[i + 1];
             outoption = true;
+        } else if (strcmp(argv[i], "-n") == 0) {
+            num_samples = atoll(argv[i + 1]);
+        } else if (strcmp(argv[i], "-g") == 0) {
+            grid = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-s") == 0) {
+            seed = atoll(argv[i + 1]);
+        } else if (strcmp(argv[i], "-threads") == 0) {
+            num_threads = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-ib") == 0) {
+            i_bound = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-me") == 0) {
+            max_entries = atoll(argv[i + 1]);
+        } else if (strcmp(argv[i], "-spacing") == 0) {
+            spacing = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-presolve") == 0) {
+            presolve = atoi(argv[i + 1]) != 0;
+        } else if (strcmp(argv[i], "-reorder") == 0) {
+            reorder = atoi(argv[i + 1]) != 0;
+        } else if (strcmp(argv[i], "-e") == 0) {
+            evidence_filename = argv[i + 1];
         } else if (strcmp(argv[i], "-h") == 0) {
             print_help(argv[0]);
             exit(-1);
@@ -80,27 +274,78 @@ int main(int argc, char *argv[]) {
         print_help(argv[0]);
         exit(-1);
     }
+    if (num_samples < grid || grid < 1 || num_threads < 1) {
+        cerr << "Need at least one thread and as many samples as quantiles\n";
+        print_help(argv[0]);
+        exit(-1);
+    }
 
 
     ofstream out(out_filename);
     MN mn;
-    mn.readMN(uai_filename);
-    int num_samples = 1000000;
-    vector<long double> q(num_samples);
-    for (int i = 0; i < num_samples; i++) {
-        for (int j = 0; j < mn.variables.size(); j++) {
-            mn.variables[j]->value = rand() % mn.variables[j]->domain_size;
-        }
-        q[i] = mn.getValue();
-    }
-    sort(q.begin(), q.end());
+    mn.readMN(uai_filename, evidence_filename);
+    mn.hard_constraints(mn);
+    if (presolve)
+        mn.presolve(mn);
+    if (reorder)
+        mn.reorder(mn);
+    mn.share_tables(mn);
     out.precision(20);
-    for (int i = 0; i < 21; i++) {
-        if (i == 0) {
-            out << q[i] << endl;
-        } else {
-            out << q[i * 50000 - 1] << endl;
-        }
+    if (spacing == 1) {
+        // q values below the min log-weight are infeasible and those above the max unconstrained
+        int induced_width;
+        vector<int> order = mn.min_fill_ordering(induced_width);
+        // The largest i-bound up to -ib whose messages fit in max_entries; the messages of the
+        // minimization have the same scopes
+        while (i_bound > 0 && mn.mini_bucket_entries(mn.potentials, order, i_bound, max_entries) > max_entries)
+            i_bound--;
+        long double min_achieved, max_achieved;
+        bool min_exact, max_exact;
+        long double min_weight = extreme_weight(mn, order, i_bound, true, min_achieved, min_exact);
+        long double max_weight = extreme_weight(mn, order, i_bound, false, max_achieved, max_exact);
+        cout.precision(20);
+        cout << "Induced width = " << induced_width << ", i-bound = " << i_bound << endl;
+        cout << "Min log-weight " << (min_exact ? "= " : ">= ") << min_weight << ", achieved = " << min_achieved << endl;
+        cout << "Max log-weight " << (max_exact ? "= " : "<= ") << max_weight << ", achieved = " << max_achieved << endl;
+        // Evenly spaced between the weights of assignments found, so every q is feasible
+        for (int i = 0; i <= grid; i++)
+            out << min_achieved + (max_achieved - min_achieved) * i / grid << endl;
+        out.close();
+        return 0;
+    }
+    FlatNetwork network(mn);
+    // Thread t fills the blocks t, t + num_threads, ... of the samples
+    vector<double> q(num_samples);
+    vector<std::thread> threads;
+    for (int t = 0; t < num_threads; t++)
+        threads.push_back(std::thread(sample_blocks, &network, seed, num_samples, t, num_threads, q.data()));
+    for (auto& thread : threads)
+        thread.join();
+    // Samples hitting a zero entry have no weight
+    q.erase(std::remove_if(q.begin(), q.end(), [](double w) { return std::isinf(w); }), q.end());
+    if (q.size() < num_samples)
+        cout << "Samples with probability zero = " << num_samples - q.size() << endl;
+    if (q.size() < grid) {
+        cerr << "Fewer samples with positive probability than quantiles\n";
+        exit(-1);
+    }
+    long long feasible = q.size();
+    // The minimum and the i/grid quantiles, each selected in the part above the previous one
+    vector<long long> positions(1, 0);
+    for (int i = 1; i <= grid; i++)
+        positions.push_back(feasible * i / grid - 1);
+    long long selected = 0;
+    vector<long double> quantiles;
+    for (long long position : positions) {
+        std::nth_element(q.begin() + selected, q.begin() + position, q.end());
+        quantiles.push_back(q[position]);
+        selected = position;
+    }
+    for (int i = 0; i <= grid; i++) {
+        if (spacing == 2)
+            out << quantiles[0] + (quantiles[grid] - quantiles[0]) * i / grid << endl;
+        else
+            out << quantiles[i] << endl;
     }
     out.close();
     return 0;
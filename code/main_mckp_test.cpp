@@ -34,7 +34,7 @@
 
 extern long double
 greedy_solve_MCKP(vector<vector<long double> > &weights, vector<vector<long double> > &profits, long double max_cost,
-                 vector<int> &solution);
+                 vector<long long> &solution, std::mt19937 *generator = nullptr);
 
 void print_help(const string &program_name) {
     cerr << "Usage: " << program_name << " -n <num-bins> -s <size of each bin> -i <max-int-size> -seed <seed> \n";
@@ -81,7 +81,7 @@ int main(int argc, char *argv[]) {
         }
         max_cost += weights[i][rand() % size_bin];
     }
-    vector<int> solution;
+    vector<long long> solution;
     cout<<"Greedy algorithm solution  = "<<greedy_solve_MCKP(weights, values, max_cost, solution)<<endl;
 
     using namespace operations_research;